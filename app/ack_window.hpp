@@ -1,21 +1,43 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <chrono>
 
 static const int32_t SRT_SEQNO_NONE = -1;    // -1: no seq (0 is a valid seqno!)
 
+/// Send times of the latest SIZE ACK packets.
+///
+/// ACK numbers are assigned monotonically, so the record of an ACK lives in the slot ackno % SIZE
+/// and is found without a search. A slot remembers the ACK number it holds (generation check),
+/// so an ACKACK for an overwritten record is detected.
+///
+/// The window is written by one thread (the ACK sender: store() and update())
+/// and read by another one (the reply loop: acknowledge()) without a lock.
+/// Each slot is guarded by a sequence counter (seqlock): the reader retries
+/// if the slot was modified while being read.
+///
+/// Send times are stored as 32-bit microsecond offsets from the creation of the window,
+/// and RTT is calculated modulo 2^32, which is valid for RTT below 35 minutes.
 template <size_t SIZE>
 class ack_window
 {
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
     using steady_clock = std::chrono::steady_clock;
     using system_clock = std::chrono::system_clock;
 public:
-    ack_window() :
-        records_(),
-        latest_idx(0),
-        oldest_idx(0)
+    ack_window()
+        : base_time_std_(steady_clock::now())
+        , base_time_sys_(system_clock::now())
+        , last_acked_(SRT_SEQNO_NONE)
     {
-        records_[0].ackno = SRT_SEQNO_NONE;
+        for (entry& e : records_)
+        {
+            e.version.store(0, std::memory_order_relaxed);
+            e.ackno.store(SRT_SEQNO_NONE, std::memory_order_relaxed);
+            e.sendtime_std.store(0, std::memory_order_relaxed);
+            e.sendtime_sys.store(0, std::memory_order_relaxed);
+        }
     }
 
     ~ack_window() {}
@@ -25,18 +47,25 @@ public:
 
     struct entry
     {
-        int32_t ackno;       // Seq. No. for the ACK packet
-        int32_t pktseqno;    // Data Seq. No. carried by the ACK packet
-        steady_clock::time_point sendtime_std; // The timestamp when the ACK was sent further (steady clock)
-        system_clock::time_point sendtime_sys; // The timestamp when the ACK was sent further (system clock)
+        std::atomic<uint32_t> version;      // Odd while the record is being written
+        std::atomic<int32_t>  ackno;        // Seq. No. for the ACK packet
+        std::atomic<uint32_t> sendtime_std; // The time when the ACK was sent further, us since creation (steady clock)
+        std::atomic<uint32_t> sendtime_sys; // The time when the ACK was sent further, us since creation (system clock)
     };
 
-    /// Write an ACK record into the window.
+    /// Write an ACK record into the window. Called by the sender only.
     /// @param [in] ackno         ACK packet no.
-    /// @param [in] pktseqno      packer number of a packet being acknowledged
     /// @param [in] send_time_std time when ACK was sent (steady clock)
     /// @param [in] send_time_sys time when ACK was sent (system clock)
-    void store(int32_t ackno, int32_t pktseqno, const steady_clock::time_point& send_time_std, const system_clock::time_point& send_time_sys);
+    void store(int32_t ackno, const steady_clock::time_point& send_time_std, const system_clock::time_point& send_time_sys);
+
+    /// Update the send time of an ACK record still waiting for its ACKACK,
+    /// e.g. with a more precise kernel TX timestamp. Called by the sender only.
+    /// @param [in] ackno         ACK packet no.
+    /// @param [in] send_time_std time when ACK was sent (steady clock)
+    /// @param [in] send_time_sys time when ACK was sent (system clock)
+    /// @return false if the record is no longer in the window (already acknowledged or overwritten).
+    bool update(int32_t ackno, const steady_clock::time_point& send_time_std, const system_clock::time_point& send_time_sys);
 
     struct rtt_pair
     {
@@ -44,36 +73,72 @@ public:
         int rtt_sys;
     };
 
-    /// Search the ACK-2 "seq" in the window, find out the DATA "ack" and calculate RTT.
-    /// @param [in] seq ACK-2 seq. no.
+    /// Find the ACK record of an ACKACK and calculate RTT. Called by the receiver only.
+    /// Acknowledging a record also discards all older ones.
+    /// @param [in] ackno ACK-2 seq. no.
     /// @param [in] recv_time_std time when ACKACK was received (steady clock)
     /// @param [in] recv_time_sys time when ACKACK was received (system clock)
-    /// @return RTT.
+    /// @return RTT, or { -1, -1 } if there is no such record.
     rtt_pair acknowledge(int32_t ackno, const std::chrono::steady_clock::time_point& recv_time_std,
         const std::chrono::system_clock::time_point& recv_time_sys);
 
 private:
+    entry& slot(int32_t ackno) { return records_[static_cast<uint32_t>(ackno) & (SIZE - 1)]; }
 
-    entry records_[SIZE];
-    int latest_idx;                 // Index of the lastest ACK record
-    int oldest_idx;                 // Index of the oldest ACK record
+    template <class Clock>
+    static uint32_t relative_us(const typename Clock::time_point& t, const typename Clock::time_point& base)
+    {
+        // Truncated to 32 bits on purpose: differences are taken modulo 2^32.
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(t - base).count());
+    }
+
+    void write(entry& e, int32_t ackno, uint32_t sendtime_std, uint32_t sendtime_sys);
 
+    entry records_[SIZE];
+    const steady_clock::time_point base_time_std_;
+    const system_clock::time_point base_time_sys_;
+    std::atomic<int32_t> last_acked_; // The latest acknowledged ACK no. (written by the receiver)
 };
 
 template<size_t SIZE>
-inline void ack_window<SIZE>::store(int32_t ackno, int32_t pktseqno, const std::chrono::steady_clock::time_point& send_time_std,
-    const std::chrono::system_clock::time_point& send_time_sys)
+inline void ack_window<SIZE>::write(entry& e, int32_t ackno, uint32_t sendtime_std, uint32_t sendtime_sys)
 {
-    records_[latest_idx].ackno = ackno;
-    records_[latest_idx].pktseqno = pktseqno;
-    records_[latest_idx].sendtime_std = send_time_std;
-    records_[latest_idx].sendtime_sys = send_time_sys;
+    const uint32_t version = e.version.load(std::memory_order_relaxed);
+    e.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-    latest_idx = (latest_idx + 1) % SIZE;
+    e.ackno.store(ackno, std::memory_order_relaxed);
+    e.sendtime_std.store(sendtime_std, std::memory_order_relaxed);
+    e.sendtime_sys.store(sendtime_sys, std::memory_order_relaxed);
 
-    // overwrite the oldest ACK
-    if (latest_idx == oldest_idx)
-        oldest_idx = (oldest_idx + 1) % SIZE;
+    e.version.store(version + 2, std::memory_order_release);
+}
+
+template<size_t SIZE>
+inline void ack_window<SIZE>::store(int32_t ackno, const std::chrono::steady_clock::time_point& send_time_std,
+    const std::chrono::system_clock::time_point& send_time_sys)
+{
+    write(slot(ackno), ackno, relative_us<steady_clock>(send_time_std, base_time_std_),
+        relative_us<system_clock>(send_time_sys, base_time_sys_));
+}
+
+template<size_t SIZE>
+inline bool ack_window<SIZE>::update(int32_t ackno, const std::chrono::steady_clock::time_point& send_time_std,
+    const std::chrono::system_clock::time_point& send_time_sys)
+{
+    // The sender is the only writer, so the slot can be read without the version check.
+    entry& e = slot(ackno);
+    if (e.ackno.load(std::memory_order_relaxed) != ackno)
+        return false;
+
+    // Already acknowledged (possibly by a newer ACKACK).
+    const int32_t last_acked = last_acked_.load(std::memory_order_acquire);
+    if (last_acked != SRT_SEQNO_NONE && int32_t(uint32_t(ackno) - uint32_t(last_acked)) <= 0)
+        return false;
+
+    write(e, ackno, relative_us<steady_clock>(send_time_std, base_time_std_),
+        relative_us<system_clock>(send_time_sys, base_time_sys_));
+    return true;
 }
 
 // C++11 Standard Section 14.6 Name Resolution:
@@ -84,67 +149,37 @@ inline typename ack_window<SIZE>::rtt_pair ack_window<SIZE>::acknowledge(int32_t
     const std::chrono::steady_clock::time_point& recv_time_std,
     const std::chrono::system_clock::time_point& recv_time_sys)
 {
-    using namespace std::chrono;
-    int32_t pktseqno = SRT_SEQNO_NONE; // TODO: consider returning as a pair. Unused now.
+    // Duplicate or reordered ACKACK: the record has been discarded.
+    const int32_t last_acked = last_acked_.load(std::memory_order_relaxed);
+    if (last_acked != SRT_SEQNO_NONE && int32_t(uint32_t(ackno) - uint32_t(last_acked)) <= 0)
+        return { -1, -1 };
 
-    if (latest_idx >= oldest_idx)
+    const entry& e = slot(ackno);
+    int32_t  rec_ackno;
+    uint32_t sendtime_std, sendtime_sys;
+    for (;;)
     {
-        // Head has not exceeded the physical boundary of the window
+        const uint32_t version = e.version.load(std::memory_order_acquire);
+        if (version & 1)
+            continue; // The sender is in the middle of writing the slot.
 
-        for (int i = oldest_idx, n = latest_idx; i < n; ++i)
-        {
-            // looking for identical ACK Seq. No.
-            if (ackno == records_[i].ackno)
-            {
-                // return the Data ACK it carried
-                pktseqno = records_[i].pktseqno;
-
-                // calculate RTT
-                const int rtt_std = (int) duration_cast<microseconds>(recv_time_std - records_[i].sendtime_std).count();
-                const int rtt_sys = (int) duration_cast<microseconds>(recv_time_sys - records_[i].sendtime_sys).count();
-
-                if (i + 1 == latest_idx)
-                {
-                    oldest_idx = latest_idx = 0;
-                    records_[0].ackno = SRT_SEQNO_NONE;
-                }
-                else
-                    oldest_idx = (i + 1) % SIZE;
-
-                return { rtt_std, rtt_sys };
-            }
-        }
+        rec_ackno    = e.ackno.load(std::memory_order_relaxed);
+        sendtime_std = e.sendtime_std.load(std::memory_order_relaxed);
+        sendtime_sys = e.sendtime_sys.load(std::memory_order_relaxed);
 
-        // Bad input, the ACK node has been overwritten
-        return { -1, -1 };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.version.load(std::memory_order_relaxed) == version)
+            break;
     }
 
-    // Head has exceeded the physical window boundary, so it is behind tail
-    for (int j = oldest_idx, n = latest_idx + SIZE; j < n; ++j)
-    {
-        // looking for indentical ACK seq. no.
-        if (ackno == records_[j % SIZE].ackno)
-        {
-            // return Data ACK
-            j %= SIZE;
-            pktseqno = records_[j].pktseqno;
-
-            // calculate RTT
-            const int rtt_std = (int) duration_cast<microseconds>(recv_time_std - records_[j].sendtime_std).count();
-            const int rtt_sys = (int)duration_cast<microseconds>(recv_time_sys - records_[j].sendtime_sys).count();
-
-            if (j == latest_idx)
-            {
-                oldest_idx = latest_idx = 0;
-                records_[0].ackno = SRT_SEQNO_NONE;
-            }
-            else
-                oldest_idx = (j + 1) % SIZE;
-
-            return { rtt_std, rtt_sys };
-        }
-    }
+    // Bad input, the ACK node has been overwritten
+    if (rec_ackno != ackno)
+        return { -1, -1 };
+
+    last_acked_.store(ackno, std::memory_order_release);
 
-    // bad input, the ACK node has been overwritten
-    return { -1, -1 };
+    const uint32_t recv_std = relative_us<steady_clock>(recv_time_std, base_time_std_);
+    const uint32_t recv_sys = relative_us<system_clock>(recv_time_sys, base_time_sys_);
+    return { static_cast<int>(static_cast<int32_t>(recv_std - sendtime_std)),
+        static_cast<int>(static_cast<int32_t>(recv_sys - sendtime_sys)) };
 }
@@ -0,0 +1,75 @@
+#include "convert.hpp"
+#include "stats_logger.hpp"
+#include "trace_archive.hpp"
+#include "trace_file.hpp"
+#include "trace_ring.hpp"
+
+using namespace std;
+#define LOG_CONVERT "[CONVERT] "
+
+void read_trace_rows(const string& filename, const function<void(const trace_row&)>& on_row)
+{
+    if (is_trace_archive(filename))
+    {
+        // Decoded block by block, so the archive does not have to fit into memory.
+        trace_archive_reader reader(filename);
+        trace_row row;
+        while (reader.next(row))
+            on_row(row);
+    }
+    else if (is_trace_ring(filename))
+    {
+        // From the oldest row still in the flight recorder file.
+        const trace_ring_reader reader(filename);
+        for (uint64_t i = reader.first(); i < reader.end(); ++i)
+            on_row(reader.row(i));
+    }
+    else
+    {
+        const trace_file_reader reader(filename);
+        for (size_t i = 0; i < reader.size(); ++i)
+            on_row(reader.row(i));
+    }
+}
+
+bool run_convert(const convert_config& cfg)
+{
+    try
+    {
+        ofstream out(cfg.output);
+        if (!out)
+            throw runtime_error("Failed to open " + cfg.output + "!!!");
+        write_csv_header(out, cfg.compact_trace);
+        csv_formatter csv(cfg.compact_trace);
+        const auto write_row = [&out, &csv](const trace_row& row) {
+            const string_view line = csv.format(to_trace_record(row));
+            out.write(line.data(), line.size());
+        };
+
+        size_t rows = 0;
+        read_trace_rows(cfg.input, [&](const trace_row& row) {
+            write_row(row);
+            ++rows;
+        });
+
+        if (!out.flush())
+            throw runtime_error("Failed to write " + cfg.output);
+
+        spdlog::info(LOG_CONVERT "Converted {} rows of {} to {}.", rows, cfg.input, cfg.output);
+        return true;
+    }
+    catch (const runtime_error& e)
+    {
+        spdlog::error(LOG_CONVERT "{}", e.what());
+        return false;
+    }
+}
+
+CLI::App* add_convert_subcommand(CLI::App& app, convert_config& cfg)
+{
+    CLI::App* sc_convert = app.add_subcommand("convert", "Convert a binary trace, a trace archive or a flight recorder file to CSV");
+    sc_convert->add_option("input", cfg.input, "Binary trace, trace archive or flight recorder file")->required();
+    sc_convert->add_option("output", cfg.output, "CSV trace file")->required();
+    sc_convert->add_flag("--compact-trace", cfg.compact_trace, "Write compact trace file without drift correction artifacts");
+    return sc_convert;
+}
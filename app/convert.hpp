@@ -0,0 +1,27 @@
+#pragma once
+#include "stdafx.hpp"
+#include <functional>
+
+#include "trace_file.hpp"
+
+// Third party libraries
+#include "CLI/CLI.hpp"
+
+
+struct convert_config
+{
+    std::string input;          // binary trace, trace archive or flight recorder file
+    std::string output;         // CSV trace
+    bool compact_trace = false; // skip the drift columns
+};
+
+
+/// Read the rows of a binary trace, a trace archive or a flight recorder file.
+/// @throws std::runtime_error if the file can't be read.
+void read_trace_rows(const std::string& filename, const std::function<void(const trace_row&)>& on_row);
+
+/// Convert a binary trace, a trace archive or a flight recorder file to a CSV trace.
+/// @returns false if the conversion failed (the error is logged).
+bool run_convert(const convert_config& cfg);
+
+CLI::App* add_convert_subcommand(CLI::App& app, convert_config& cfg);
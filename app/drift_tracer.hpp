@@ -1,6 +1,9 @@
 #pragma once
 #include "stdafx.hpp"
 
+#include "kalman_drift_tracer.hpp"
+#include "sliding_median.hpp"
+
 /// This class is useful in every place where
 /// the time drift should be traced. It's currently in use in every
 /// solution that implements any kind of TSBPD.
@@ -34,7 +37,7 @@ public:
         if (m_uDriftSpan < MAX_SPAN)
             return false;
 
-        // Calculate the median of all drift values.
+        // Calculate the mean of all drift values (see MedianDriftTracer for the median).
         // In most cases, the divisor should be == MAX_SPAN.
         m_qDrift = m_qDriftSum / m_uDriftSpan;
 
@@ -89,4 +92,42 @@ public:
     // overdrift.
     int64_t drift() const { return m_qDrift; }
     int64_t overdrift() const { return m_qOverdrift; }
-};
\ No newline at end of file
+};
+
+/// Drift tracer taking the median of the last MAX_SPAN drift samples instead of the mean of
+/// a block of them, so a few delayed ACKACKs do not drag the drift.
+///
+/// The median is updated with every sample in O(log MAX_SPAN). The drift is checked against MAX_DRIFT
+/// with every sample once the window is full. update() returns true only when the time base
+/// has to be shifted by overdrift(), and the overdrift is cleared with the next sample
+/// (as DriftTracer with CLEAR_ON_UPDATE).
+template<unsigned MAX_SPAN, int MAX_DRIFT>
+class MedianDriftTracer
+{
+    // The samples are kept relative to the initial time base, so the window
+    // stays valid after the time base is shifted.
+    sliding_median<int64_t, MAX_SPAN> m_window;
+    int64_t m_qShifts = 0;
+
+    int64_t m_qDrift = 0;
+    int64_t m_qOverdrift = 0;
+
+public:
+    bool update(int64_t driftval)
+    {
+        m_qOverdrift = 0;
+        m_window.push(driftval + m_qShifts);
+        m_qDrift = m_window.median() - m_qShifts;
+
+        if (m_window.size() < MAX_SPAN || std::abs(m_qDrift) <= MAX_DRIFT)
+            return false;
+
+        m_qOverdrift = m_qDrift < 0 ? -MAX_DRIFT : MAX_DRIFT;
+        m_qDrift -= m_qOverdrift;
+        m_qShifts += m_qOverdrift;
+        return true;
+    }
+
+    int64_t drift() const { return m_qDrift; }
+    int64_t overdrift() const { return m_qOverdrift; }
+};
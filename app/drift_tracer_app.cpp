@@ -48,6 +48,8 @@ inline void SysCleanupNetwork() {}
 #endif
 
 #include "start.hpp"
+#include "convert.hpp"
+#include "replay.hpp"
 
 using namespace std;
 
@@ -104,6 +106,12 @@ int main(int argc, char **argv)
     config cfg;
     CLI::App* sc_send = add_subcommand(app, cfg, url);
 
+    convert_config convert_cfg;
+    CLI::App* sc_convert = add_convert_subcommand(app, convert_cfg);
+
+    replay_config replay_cfg;
+    CLI::App* sc_replay = add_replay_subcommand(app, replay_cfg);
+
     app.require_subcommand(1);
     CLI11_PARSE(app, argc, argv);
 
@@ -115,6 +123,14 @@ int main(int argc, char **argv)
         run(url, cfg, force_break);
         return 0;
     }
+    else if (sc_convert->parsed())
+    {
+        return run_convert(convert_cfg) ? 0 : 1;
+    }
+    else if (sc_replay->parsed())
+    {
+        return run_replay(replay_cfg) ? 0 : 1;
+    }
     else
     {
         cerr << "Failed to recognize subcommand" << endl;
@@ -0,0 +1,94 @@
+#include "flight_recorder.hpp"
+#include <algorithm>
+#include <filesystem>
+
+#define LOG_TRACE "[TRACE] "
+
+using namespace std;
+
+const char* anomaly_detector::check(const trace_record& rec)
+{
+    const char* anomaly = nullptr;
+
+    // The drift tracer shifts the time base by the overdrift and resets it with the next sample.
+    if (rec.overdrift != 0)
+        anomaly = "tsbpd_shift";
+    else if (samples_ >= warmup_samples && rec.rtt_std - rtt_rma_ > max(spike_factor * rtt_var_, min_spike_us))
+        anomaly = "rtt_spike";
+
+    ++samples_;
+    rtt_rma_ = rec.rtt_std_rma;
+    rtt_var_ = rec.rtt_std_var;
+    return anomaly;
+}
+
+flight_recorder::flight_recorder(const string& filename, size_t file_size, const string& config, bool append)
+    : filename_(filename)
+    , config_(config)
+    , ring_(filename, file_size, config, append)
+    , window_(min(max_window, (ring_.capacity() - 1) / 2))
+{
+    if (ring_.written())
+        spdlog::info(LOG_TRACE "{}: flight recorder of {} rows, continued after {} rows.", filename_, ring_.capacity(),
+            ring_.written());
+    else
+        spdlog::info(LOG_TRACE "{}: flight recorder of {} rows.", filename_, ring_.capacity());
+}
+
+flight_recorder::~flight_recorder()
+{
+    if (pending_)
+        save_snapshot();
+    ring_.sync();
+}
+
+void flight_recorder::write(const trace_record& rec)
+{
+    const char* anomaly = detector_.check(rec);
+    if (anomaly && !pending_)
+    {
+        // Anomalies within the window after this one are saved in the same snapshot.
+        pending_ = true;
+        trigger_ = ring_.written();
+        reason_  = anomaly;
+        spdlog::warn(LOG_TRACE "{}: {} anomaly (RTT {} us, smoothed {} us, var {} us, overdrift {} us).", filename_,
+            anomaly, rec.rtt_std, rec.rtt_std_rma, rec.rtt_std_var, rec.overdrift);
+    }
+
+    ring_.write(to_trace_row(rec));
+
+    if (pending_ && ring_.written() > trigger_ + window_)
+        save_snapshot();
+}
+
+void flight_recorder::save_snapshot()
+{
+    pending_ = false;
+
+    // trace.bin -> trace-anomaly-1-rtt_spike.bin, skipping the names taken by previous sessions.
+    const size_t dot  = filename_.find_last_of('.');
+    const size_t sep  = filename_.find_last_of("/\\");
+    const bool   ext  = dot != string::npos && (sep == string::npos || dot > sep);
+    const string stem = ext ? filename_.substr(0, dot) : filename_;
+    string snapshot_name;
+    do
+    {
+        snapshot_name = stem + "-anomaly-" + to_string(++snapshots_) + "-" + reason_ + ".bin";
+    } while (filesystem::exists(snapshot_name));
+
+    const uint64_t first = max(ring_.first(), trigger_ > window_ ? trigger_ - window_ : 0);
+    try
+    {
+        trace_file_writer snapshot(snapshot_name,
+            config_ + ";anomaly=" + reason_ + ";anomaly_row=" + to_string(trigger_ - first));
+        for (uint64_t i = first; i < ring_.written(); ++i)
+            snapshot.write(ring_.row(i));
+
+        spdlog::info(LOG_TRACE "{}: saved {} rows around the {} anomaly to {}.", filename_, ring_.written() - first,
+            reason_, snapshot_name);
+    }
+    catch (const runtime_error& e)
+    {
+        spdlog::error(LOG_TRACE "{}", e.what());
+    }
+}
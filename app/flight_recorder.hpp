@@ -0,0 +1,68 @@
+#pragma once
+#include "stdafx.hpp"
+
+#include "stats_logger.hpp"
+#include "trace_ring.hpp"
+
+/// Detects anomalies in the sequence of trace rows of a peer.
+class anomaly_detector
+{
+public:
+    /// @returns The name of the anomaly the row shows, or nullptr.
+    ///  - "rtt_spike": the RTT sample exceeds the smoothed RTT by more than spike_factor RTT variances;
+    ///  - "tsbpd_shift": the TSBPD time base has been shifted to compensate the drift.
+    const char* check(const trace_record& rec);
+
+private:
+    static constexpr int warmup_samples = 16;  // the smoothed RTT and its variance settle first
+    static constexpr int spike_factor   = 4;
+    static constexpr int min_spike_us   = 500; // ignore spikes smaller than this regardless of the variance
+
+    int samples_  = 0;
+    int rtt_rma_  = 0; // smoothed RTT and its variance before the current sample
+    int rtt_var_  = 0;
+};
+
+/// Always-on tracing with bounded disk usage.
+///
+/// The latest rows are kept in a fixed-size circular file (see trace_ring.hpp). When the anomaly
+/// detector fires, the rows before the anomaly and the same number of rows after it
+/// are saved to a separate binary trace (snapshot).
+class flight_recorder
+{
+public:
+    /// @param filename   circular trace file; snapshots are named after it, e.g. "trace-anomaly-1-rtt_spike.bin"
+    /// @param file_size  the size of the circular trace file
+    /// @param config     description of the tracing configuration stored in the files
+    /// @param append     continue the rows of an existing circular trace file (see trace_ring_writer)
+    /// @throws std::runtime_error if the file can't be created or its disk space reserved.
+    flight_recorder(const std::string& filename, size_t file_size, const std::string& config, bool append = false);
+
+    /// Saves the pending snapshot with the rows collected so far.
+    ~flight_recorder();
+
+    flight_recorder(const flight_recorder&) = delete;
+    flight_recorder& operator=(const flight_recorder&) = delete;
+
+    void write(const trace_record& rec);
+
+    /// Schedule writing the circular file to the disk.
+    void sync() { ring_.sync(); }
+
+private:
+    void save_snapshot();
+
+private:
+    static constexpr uint64_t max_window = 1000; // rows before and after an anomaly to save
+
+    const std::string filename_;
+    const std::string config_;
+    trace_ring_writer ring_;
+    anomaly_detector  detector_;
+    const uint64_t    window_;
+
+    bool        pending_ = false; // collecting the rows after an anomaly
+    uint64_t    trigger_ = 0;     // the row no. of the anomaly
+    std::string reason_;
+    int         snapshots_ = 0;
+};
@@ -1,3 +1,4 @@
+#pragma once
 #include "stdafx.hpp"
 
 #include "ack_window.hpp"
@@ -7,8 +8,34 @@ struct path_metrics
     //path_metrics() {};
     //path_metrics(path_metrics&& pp) {};
 
+    // Updated only from the reply loop.
     int rtt     = 0;
     int rtt_var = 0;
+    uint64_t invalid_ackacks = 0; // ACKACKs without an ACK record (duplicate, reordered or overwritten)
     // TODO: track lost packets
-    ack_window<1024> ack_records;
-};
\ No newline at end of file
+    ack_window<1024> ack_records; // lock-free, written by the ACK sender, read by the reply loop
+
+    struct rtt_snapshot
+    {
+        int rtt;
+        int rtt_var;
+    };
+
+    /// Make the current rtt and rtt_var visible to the ACK sender.
+    /// Both values are packed in one atomic word, so they are always read as a consistent pair.
+    void publish_rtt()
+    {
+        const uint64_t packed = (uint64_t(uint32_t(rtt)) << 32) | uint32_t(rtt_var);
+        published_rtt_.store(packed, std::memory_order_release);
+    }
+
+    /// @returns RTT and RTTVar last published by the reply loop (lock-free).
+    rtt_snapshot published_rtt() const
+    {
+        const uint64_t packed = published_rtt_.load(std::memory_order_acquire);
+        return { int(uint32_t(packed >> 32)), int(uint32_t(packed)) };
+    }
+
+private:
+    std::atomic<uint64_t> published_rtt_ { 0 };
+};
@@ -0,0 +1,109 @@
+#include "periodic_timer.hpp"
+
+#include <thread>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+#define LOG_TIMER "[TIMER] "
+
+periodic_timer::periodic_timer(const steady_clock::duration& period)
+    : m_period(period)
+    , m_deadline(steady_clock::now() + period)
+{
+    if (period <= steady_clock::duration::zero())
+        throw runtime_error("Timer period must be positive");
+
+#if defined(__linux__)
+    m_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (m_fd < 0)
+        throw runtime_error("Failed to create timerfd. Error code: " + to_string(errno));
+
+    const auto to_timespec = [](const steady_clock::duration& d) {
+        const auto ns = duration_cast<nanoseconds>(d).count();
+        timespec ts;
+        ts.tv_sec  = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        return ts;
+    };
+
+    itimerspec its = {};
+    its.it_value    = to_timespec(m_deadline.time_since_epoch());
+    its.it_interval = to_timespec(m_period);
+    if (::timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &its, nullptr) < 0)
+    {
+        ::close(m_fd);
+        throw runtime_error("Failed to arm timerfd. Error code: " + to_string(errno));
+    }
+#endif
+}
+
+periodic_timer::~periodic_timer()
+{
+#if defined(__linux__)
+    if (m_fd >= 0)
+        ::close(m_fd);
+#endif
+}
+
+steady_clock::time_point periodic_timer::wait()
+{
+#if defined(__linux__)
+    for (;;)
+    {
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        const int res = ::poll(&pfd, 1, -1);
+        if (res < 0 && errno != EINTR)
+            throw runtime_error("periodic_timer: poll failed. Error code: " + to_string(errno));
+
+        const auto deadline = on_expired();
+        if (deadline != steady_clock::time_point())
+            return deadline;
+    }
+#else
+    this_thread::sleep_until(m_deadline);
+
+    // Count the deadlines that have passed while the thread was busy or asleep.
+    const auto tnow = steady_clock::now();
+    const uint64_t expirations = 1 + (tnow - m_deadline) / m_period;
+    return on_tick(expirations);
+#endif
+}
+
+steady_clock::time_point periodic_timer::on_expired()
+{
+#if defined(__linux__)
+    uint64_t expirations = 0;
+    if (::read(m_fd, &expirations, sizeof expirations) != sizeof expirations || expirations == 0)
+        return steady_clock::time_point();
+    return on_tick(expirations);
+#else
+    if (steady_clock::now() < m_deadline)
+        return steady_clock::time_point();
+    const uint64_t expirations = 1 + (steady_clock::now() - m_deadline) / m_period;
+    return on_tick(expirations);
+#endif
+}
+
+steady_clock::time_point periodic_timer::on_tick(uint64_t expirations)
+{
+    const auto tnow = steady_clock::now();
+
+    // The tick is for the latest passed deadline, the earlier ones are missed.
+    const auto deadline = m_deadline + m_period * (expirations - 1);
+    m_deadline = deadline + m_period;
+
+    m_last_lateness = tnow - deadline;
+    ++m_stats.ticks;
+    m_stats.missed += expirations - 1;
+    m_stats.lateness_sum += m_last_lateness;
+    m_stats.lateness_max = max(m_stats.lateness_max, m_last_lateness);
+
+    return deadline;
+}
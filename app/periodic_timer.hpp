@@ -0,0 +1,54 @@
+#pragma once
+#include "stdafx.hpp"
+
+/// Fires on absolute deadlines: start + k * period.
+/// Unlike a relative sleep, processing time and wakeup slack of a tick do not shift the following ticks.
+/// Uses timerfd on Linux (CLOCK_MONOTONIC, same as steady_clock), sleep_until elsewhere.
+class periodic_timer
+{
+    using steady_clock = std::chrono::steady_clock;
+public:
+    explicit periodic_timer(const steady_clock::duration& period);
+    ~periodic_timer();
+
+    periodic_timer(const periodic_timer&) = delete;
+    periodic_timer& operator=(const periodic_timer&) = delete;
+
+    /// Wait for the next deadline. Deadlines that have already passed are skipped (counted as missed).
+    /// @returns The deadline of the tick.
+    steady_clock::time_point wait();
+
+    /// File descriptor that becomes readable on every deadline (Linux), -1 otherwise.
+    /// When it is polled instead of calling wait(), on_expired() must be called.
+    int fd() const { return m_fd; }
+
+    /// Consume the expiration of a readable fd().
+    /// @returns The deadline of the tick, or zero time point if the timer has not expired yet.
+    steady_clock::time_point on_expired();
+
+    const steady_clock::duration& period() const { return m_period; }
+
+    /// Wakeup lateness statistics.
+    struct stats
+    {
+        uint64_t ticks  = 0;
+        uint64_t missed = 0; // deadlines that passed without a tick
+        steady_clock::duration lateness_sum = steady_clock::duration::zero();
+        steady_clock::duration lateness_max = steady_clock::duration::zero();
+    };
+
+    const stats& get_stats() const { return m_stats; }
+
+    /// The lateness of the latest tick: how long after the deadline the thread woke up.
+    const steady_clock::duration& last_lateness() const { return m_last_lateness; }
+
+private:
+    steady_clock::time_point on_tick(uint64_t expirations);
+
+private:
+    const steady_clock::duration m_period;
+    int                          m_fd = -1;
+    steady_clock::time_point     m_deadline; // the next deadline
+    steady_clock::duration       m_last_lateness = steady_clock::duration::zero();
+    stats                        m_stats;
+};
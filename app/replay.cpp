@@ -0,0 +1,297 @@
+#include "replay.hpp"
+#include "convert.hpp"
+#include "mapped_file.hpp"
+#include "trace_archive.hpp"
+#include "trace_ring.hpp"
+#include "tsbpd_dispatch.hpp"
+#include <charconv>
+#include <string_view>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+#define LOG_REPLAY "[REPLAY] "
+
+namespace
+{
+
+/// The columns of a trace row used by the replay.
+struct replay_sample
+{
+    int64_t  us_recv_std;      // ACKACK reception time (kernel timestamp mapped to steady clock if available)
+    uint32_t ackack_timestamp; // steady clock timestamp of the remote peer
+    int32_t  rtt_std;
+    int32_t  srtt_std;
+    int32_t  rtt_var_std;
+};
+
+vector<replay_sample> load_csv_samples(const string& filename)
+{
+    const mapped_file file(filename);
+    if (!file.data())
+        throw runtime_error(filename + " is empty");
+    const char*       p   = reinterpret_cast<const char*>(file.data());
+    const char* const end = p + file.size();
+
+    const auto next_line = [&p, end]() {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        const string_view line(p, (eol ? eol : end) - p);
+        p = eol ? eol + 1 : end;
+        return line;
+    };
+
+    // Traces written before the kernel timestamp column have only usElapsedStd.
+    int col_recv = -1, col_timestamp = -1, col_rtt = -1, col_srtt = -1, col_rtt_var = -1;
+    const string_view header = next_line();
+    int col = 0;
+    for (size_t pos = 0; pos <= header.size(); ++col)
+    {
+        const size_t      comma = min(header.find(',', pos), header.size());
+        const string_view name  = header.substr(pos, comma - pos);
+        if (name == "usElapsedKernelStd" || (name == "usElapsedStd" && col_recv == -1))
+            col_recv = col;
+        else if (name == "usAckAckTimestampStd")
+            col_timestamp = col;
+        else if (name == "usRTTStd")
+            col_rtt = col;
+        else if (name == "usSmoothedRTTStd")
+            col_srtt = col;
+        else if (name == "RTTVarStd")
+            col_rtt_var = col;
+        pos = comma + 1;
+    }
+    if (col_recv == -1 || col_timestamp == -1 || col_rtt == -1 || col_srtt == -1 || col_rtt_var == -1)
+        throw runtime_error(filename + " is not a drift trace: missing columns");
+
+    vector<replay_sample> samples;
+    samples.reserve(file.size() / 160); // a CSV row takes around 160 bytes
+    while (p < end)
+    {
+        const string_view line = next_line();
+        if (line.empty())
+            continue;
+
+        int64_t values[5] = {};
+        size_t  pos       = 0;
+        for (int c = 0; pos <= line.size(); ++c)
+        {
+            const size_t comma = min(line.find(',', pos), line.size());
+            const int    slot  = c == col_recv ? 0 : c == col_timestamp ? 1 : c == col_rtt ? 2
+                                : c == col_srtt ? 3 : c == col_rtt_var ? 4 : -1;
+            if (slot != -1 && from_chars(line.data() + pos, line.data() + comma, values[slot]).ec != errc())
+                throw runtime_error(filename + ": invalid row " + to_string(samples.size() + 1));
+            pos = comma + 1;
+        }
+        samples.push_back({values[0], static_cast<uint32_t>(values[1]), static_cast<int32_t>(values[2]),
+            static_cast<int32_t>(values[3]), static_cast<int32_t>(values[4])});
+    }
+    return samples;
+}
+
+vector<replay_sample> load_samples(const string& filename)
+{
+    if (is_trace_archive(filename) || is_trace_ring(filename) || is_trace_file(filename))
+    {
+        vector<replay_sample> samples;
+        read_trace_rows(filename, [&samples](const trace_row& row) {
+            samples.push_back({row.us_elapsed_kernel_std, row.us_ackack_timestamp_std, row.us_rtt_std, row.us_smoothed_rtt_std,
+                row.rtt_var_std});
+        });
+        return samples;
+    }
+
+    return load_csv_samples(filename);
+}
+
+template <class DRIFT_TRACER>
+replay_result replay_trace(const vector<replay_sample>& samples, const tsbpd_options& options)
+{
+    basic_tsbpd<DRIFT_TRACER> tsbpd_state(options);
+    replay_result res;
+    res.max_span       = options.max_span;
+    res.max_drift      = options.max_drift;
+    res.compensate_rtt = options.compensate_rtt;
+
+    double sum_abs = 0, sum_sq = 0;
+    int    srtt = 0, rtt_var = 0; // the trace has the values after the sample
+    uint64_t invalid = 0;
+    for (const replay_sample& s : samples)
+    {
+        // Traces written before such ACKACKs were dropped have them with RTT -1 (see on_ctrl_ackack()).
+        if (s.rtt_std < 0)
+        {
+            ++invalid;
+            continue;
+        }
+
+        const bool    first     = res.samples++ == 0;
+        const int64_t predicted = tsbpd_state.drift();
+        const int64_t sample    = tsbpd_state.on_ackack(s.ackack_timestamp, {s.rtt_std, srtt, rtt_var},
+            steady_clock::time_point(microseconds(s.us_recv_std)));
+        srtt    = s.srtt_std;
+        rtt_var = s.rtt_var_std;
+
+        // The first sample sets the time base.
+        if (first)
+            continue;
+
+        if (tsbpd_state.overdrift() != 0)
+        {
+            ++res.shifts;
+            res.us_shift_total += tsbpd_state.overdrift();
+        }
+
+        const int64_t residual = sample - predicted;
+        sum_abs += std::abs(residual);
+        sum_sq += double(residual) * residual;
+        res.us_residual_max_abs = max<int64_t>(res.us_residual_max_abs, std::abs(residual));
+    }
+
+    if (res.samples > 1)
+    {
+        res.us_residual_mean_abs = sum_abs / (res.samples - 1);
+        res.us_residual_rms      = sqrt(sum_sq / (res.samples - 1));
+    }
+    res.filtered_out = tsbpd_state.filter().rejected() + invalid;
+    return res;
+}
+
+using replay_fn = replay_result (*)(const vector<replay_sample>&, const tsbpd_options&);
+
+struct replay_job
+{
+    replay_fn     fn;
+    const char*   drift_tracer;
+    const char*   sample_filter;
+    tsbpd_options options;
+};
+
+} // namespace
+
+bool run_replay(const replay_config& cfg)
+{
+    try
+    {
+        vector<replay_job> jobs;
+        for (const unsigned span : cfg.max_spans)
+        {
+            for (const int drift : cfg.max_drifts)
+            {
+                for (const string& tracer : cfg.drift_tracers)
+                {
+                    // The Kalman filter has no span: once per MAX_DRIFT.
+                    const drift_tracer_kind kind = parse_drift_tracer(tracer);
+                    if (kind == drift_tracer_kind::kalman && span != cfg.max_spans.front())
+                        continue;
+
+                    replay_job job = {};
+                    job.fn = visit_drift_tracer(kind, span, drift, [](auto tag) -> replay_fn {
+                        return &replay_trace<typename decltype(tag)::type>;
+                    });
+                    job.drift_tracer         = tracer.c_str();
+                    job.options.drift_tracer = kind;
+                    job.options.max_span     = kind == drift_tracer_kind::kalman ? 0 : span;
+                    job.options.max_drift    = drift;
+                    job.options.log_events   = false;
+
+                    for (const string& rtt : cfg.compensate_rtt)
+                    {
+                        for (const string& filter : cfg.sample_filters)
+                        {
+                            job.options.compensate_rtt = rtt == "on";
+                            job.options.filter         = parse_drift_filter(filter);
+                            job.sample_filter          = filter.c_str();
+                            jobs.push_back(job);
+                        }
+                    }
+                }
+            }
+        }
+
+        ofstream out;
+        if (!cfg.output.empty())
+        {
+            out.open(cfg.output);
+            if (!out)
+                throw runtime_error("Failed to open " + cfg.output + "!!!");
+        }
+
+        const auto                  t_load  = steady_clock::now();
+        const vector<replay_sample> samples = load_samples(cfg.input);
+        const auto                  t_start = steady_clock::now();
+        spdlog::info(LOG_REPLAY "Loaded {} samples of {} in {} ms.", samples.size(), cfg.input,
+            duration_cast<milliseconds>(t_start - t_load).count());
+
+        // Each configuration is replayed by one thread, taking the next one when done.
+        vector<replay_result> results(jobs.size());
+        atomic<size_t>        next_job{0};
+        const auto            replay_jobs = [&]() {
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+            {
+                results[i]               = jobs[i].fn(samples, jobs[i].options);
+                results[i].drift_tracer  = jobs[i].drift_tracer;
+                results[i].sample_filter = jobs[i].sample_filter;
+            }
+        };
+
+        const size_t threads = min<size_t>(jobs.size(),
+            cfg.threads > 0 ? cfg.threads : max(thread::hardware_concurrency(), 1u));
+        vector<future<void>> fb_threads;
+        for (size_t i = 1; i < threads; ++i)
+            fb_threads.push_back(::async(::launch::async, replay_jobs));
+        replay_jobs();
+        for (auto& fb : fb_threads)
+            fb.wait();
+
+        const auto ms = duration_cast<milliseconds>(steady_clock::now() - t_start).count();
+        spdlog::info(LOG_REPLAY "Replayed {} configurations on {} threads in {} ms ({:.1f} M samples/s).", jobs.size(),
+            threads, ms, double(samples.size()) * jobs.size() / max<int64_t>(ms, 1) / 1000);
+
+        if (out.is_open())
+            out << "DriftTracer,MaxSpan,MaxDrift,CompensateRTT,SampleFilter,Samples,FilteredOut,Shifts,usShiftTotal,"
+                   "usResidualMeanAbs,usResidualRMS,usResidualMaxAbs\n";
+        for (const replay_result& r : results)
+        {
+            spdlog::info(LOG_REPLAY "{:6} MAX_SPAN {:5} MAX_DRIFT {:5} RTT comp. {:3} filter {:8}: {} shifts (total {} us), "
+                "residual mean abs {:.1f} us, RMS {:.1f} us, max {} us, {} samples filtered out.", r.drift_tracer,
+                r.max_span, r.max_drift, r.compensate_rtt ? "on" : "off", r.sample_filter, r.shifts, r.us_shift_total,
+                r.us_residual_mean_abs, r.us_residual_rms, r.us_residual_max_abs, r.filtered_out);
+            if (out.is_open())
+                out << fmt::format("{},{},{},{},{},{},{},{},{},{:.3f},{:.3f},{}\n", r.drift_tracer, r.max_span,
+                    r.max_drift, int(r.compensate_rtt), r.sample_filter, r.samples, r.filtered_out, r.shifts,
+                    r.us_shift_total, r.us_residual_mean_abs, r.us_residual_rms, r.us_residual_max_abs);
+        }
+
+        if (out.is_open() && !out.flush())
+            throw runtime_error("Failed to write " + cfg.output);
+        return true;
+    }
+    catch (const runtime_error& e)
+    {
+        spdlog::error(LOG_REPLAY "{}", e.what());
+        return false;
+    }
+}
+
+CLI::App* add_replay_subcommand(CLI::App& app, replay_config& cfg)
+{
+    CLI::App* sc_replay = app.add_subcommand("replay", "Replay a trace through the drift tracer with a grid of settings");
+    sc_replay->add_option("input", cfg.input, "CSV trace, binary trace, trace archive or flight recorder file")->required();
+    sc_replay->add_option("--max-span", cfg.max_spans, "Comma-separated numbers of samples to average the drift over")
+        ->delimiter(',');
+    sc_replay->add_option("--max-drift", cfg.max_drifts, "Comma-separated drift limits (us) to shift the time base at")
+        ->delimiter(',');
+    sc_replay->add_option("--drift-tracer", cfg.drift_tracers,
+            "Drift tracers to evaluate: mean (of blocks of MAX_SPAN samples), median (sliding), kalman (clock model)")
+        ->delimiter(',')
+        ->check(CLI::IsMember({"mean", "median", "kalman"}));
+    sc_replay->add_option("--compensate-rtt", cfg.compensate_rtt, "RTT compensation settings to evaluate: off, on or off,on")
+        ->delimiter(',')
+        ->check(CLI::IsMember({"off", "on"}));
+    sc_replay->add_option("--sample-filter", cfg.sample_filters, "Drift sample filters to evaluate: off, min-rtt, rtt-gate")
+        ->delimiter(',')
+        ->check(CLI::IsMember({"off", "min-rtt", "rtt-gate"}));
+    sc_replay->add_option("--threads", cfg.threads, "Number of threads (0 - one per CPU core)");
+    sc_replay->add_option("--output", cfg.output, "Write the results to a CSV file");
+    return sc_replay;
+}
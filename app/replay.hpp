@@ -0,0 +1,44 @@
+#pragma once
+#include "stdafx.hpp"
+#include <vector>
+
+// Third party libraries
+#include "CLI/CLI.hpp"
+
+
+struct replay_config
+{
+    std::string input;  // CSV trace, binary trace, trace archive or flight recorder file
+    std::string output; // CSV file with a row per configuration, empty - log only
+    std::vector<unsigned>    max_spans      = {1000}; // MAX_SPAN values of the drift tracer to evaluate
+    std::vector<int>         max_drifts     = {5000}; // MAX_DRIFT values of the drift tracer to evaluate
+    std::vector<std::string> drift_tracers  = {"mean"}; // mean (DriftTracer), median (MedianDriftTracer), kalman (KalmanDriftTracer)
+    std::vector<std::string> compensate_rtt = {"off"};
+    std::vector<std::string> sample_filters = {"off"}; // drift sample filters to evaluate (see tsbpd_options)
+    int threads = 0; // 0 - one per CPU core
+};
+
+/// Outcome of replaying a trace with one configuration of the drift tracer.
+struct replay_result
+{
+    const char* drift_tracer  = ""; // mean, median or kalman
+    const char* sample_filter = ""; // off, min-rtt or rtt-gate
+    unsigned max_span       = 0; // 0 - not applicable (kalman)
+    int      max_drift      = 0;
+    bool     compensate_rtt = false;
+    uint64_t samples        = 0;
+    uint64_t filtered_out   = 0; // samples not passed to the drift tracer, including the ones without RTT (not in samples)
+    uint64_t shifts         = 0; // TSBPD time base shifts (overdrift events)
+    int64_t  us_shift_total = 0; // the sum of the shifts
+    // Residual error: the drift sample minus the drift estimate applied at the time.
+    double   us_residual_mean_abs = 0;
+    double   us_residual_rms      = 0;
+    int64_t  us_residual_max_abs  = 0;
+};
+
+/// Run the ACKACK samples of a trace through the TSBPD and drift tracer code
+/// for each configuration of the grid, in parallel.
+/// @returns false if the replay failed (the error is logged).
+bool run_replay(const replay_config& cfg);
+
+CLI::App* add_replay_subcommand(CLI::App& app, replay_config& cfg);
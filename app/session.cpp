@@ -0,0 +1,113 @@
+#include "session.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+#define LOG_SESSION "[SESS] "
+
+bool session_table::addr_less::operator()(const sockaddr_any& lhs, const sockaddr_any& rhs) const
+{
+    // Compare only the meaningful part of the address (see sockaddr_any::Equal).
+    if (lhs.family() != rhs.family())
+        return lhs.family() < rhs.family();
+
+    if (lhs.hport() != rhs.hport())
+        return lhs.hport() < rhs.hport();
+
+    if (lhs.family() == AF_INET)
+        return memcmp(&lhs.sin.sin_addr, &rhs.sin.sin_addr, sizeof(in_addr)) < 0;
+
+    if (lhs.family() == AF_INET6)
+        return memcmp(&lhs.sin6.sin6_addr, &rhs.sin6.sin6_addr, sizeof(in6_addr)) < 0;
+
+    return false;
+}
+
+session_table::shared_session session_table::find(const sockaddr_any& peer) const
+{
+    lock_guard<mutex> lck(m_mtx);
+    const auto it = m_sessions.find(peer);
+    return it != m_sessions.end() ? it->second : nullptr;
+}
+
+session_table::shared_session session_table::find_or_create(const sockaddr_any& peer, bool remote, bool& created)
+{
+    created = false;
+    if (shared_session session = find(peer))
+        return session;
+
+    // The logger opens files and sockets, so it is created without holding m_mtx: the ACK sender takes
+    // a snapshot of the table every tick. Only the threads creating sessions wait for each other.
+    lock_guard<mutex> create_lck(m_create_mtx);
+    size_t num_sessions = 0;
+    {
+        lock_guard<mutex> lck(m_mtx);
+        const auto it = m_sessions.find(peer);
+        if (it != m_sessions.end())
+            return it->second;
+
+        if (m_sessions.size() >= m_max_sessions)
+            return nullptr;
+    }
+
+    auto session = make_shared<peer_session>(peer, remote, m_tsbpd_options);
+    if (m_make_logger)
+        session->stats = m_make_logger(peer);
+
+    {
+        lock_guard<mutex> lck(m_mtx);
+        m_sessions.emplace(peer, session);
+        num_sessions = m_sessions.size();
+    }
+
+    created = true;
+    spdlog::info(LOG_SESSION "New session with {} ({} of {}).", peer.str(), num_sessions, m_max_sessions);
+    return session;
+}
+
+void session_table::snapshot(vector<shared_session>& out) const
+{
+    out.clear();
+    lock_guard<mutex> lck(m_mtx);
+    for (const auto& s : m_sessions)
+        out.push_back(s.second);
+}
+
+size_t session_table::evict_idle(const steady_clock::duration& timeout)
+{
+    const auto tnow = steady_clock::now();
+
+    // Closing the trace files of a session may take long, so the sessions are released after unlocking.
+    vector<shared_session> evicted;
+    {
+        lock_guard<mutex> lck(m_mtx);
+        for (auto it = m_sessions.begin(); it != m_sessions.end();)
+        {
+            const peer_session& s = *it->second;
+            const auto last_activity = steady_clock::time_point(steady_clock::duration(s.last_activity.load()));
+            if (!s.remote_initiated || tnow - last_activity <= timeout)
+            {
+                ++it;
+                continue;
+            }
+
+            evicted.push_back(move(it->second));
+            it = m_sessions.erase(it);
+        }
+    }
+
+    for (const shared_session& s : evicted)
+    {
+        const auto last_activity = steady_clock::time_point(steady_clock::duration(s->last_activity.load()));
+        spdlog::info(LOG_SESSION "Session with {} is idle for {} ms, closing.", s->peer_addr.str(),
+            count_milliseconds(tnow - last_activity));
+    }
+
+    return evicted.size();
+}
+
+size_t session_table::size() const
+{
+    lock_guard<mutex> lck(m_mtx);
+    return m_sessions.size();
+}
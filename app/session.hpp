@@ -0,0 +1,97 @@
+#pragma once
+#include "stdafx.hpp"
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "netinet_any.hpp"
+#include "path.hpp"
+#include "tsbpd_dispatch.hpp"
+#include "stats_logger.hpp"
+
+/// Drift tracing state of a single peer.
+struct peer_session
+{
+    using steady_clock = std::chrono::steady_clock;
+
+    peer_session(const sockaddr_any& addr, bool remote, const tsbpd_options& tsbpd_opts)
+        : peer_addr(addr)
+        , remote_initiated(remote)
+        , tsbpd_state(make_tsbpd(tsbpd_opts))
+        , last_activity(steady_clock::now().time_since_epoch().count())
+    {
+    }
+
+    const sockaddr_any peer_addr;
+    const bool remote_initiated; // true if the session was created by an incoming ACK
+
+    path_metrics path; // shared by the ACK sender and the reply loop without a lock
+
+    // Accessed only from the reply loop.
+    std::unique_ptr<any_tsbpd>    tsbpd_state; // with the drift tracer of the options
+    std::unique_ptr<stats_logger> stats;
+    steady_clock::time_point      stats_time;
+
+    // Accessed only from the ACK sender.
+    unsigned int ackno = 1;
+
+    /// Time of the last packet received from the peer (steady clock ticks).
+    std::atomic<steady_clock::rep> last_activity;
+
+    void touch() { last_activity = steady_clock::now().time_since_epoch().count(); }
+};
+
+/// Sessions keyed by peer address.
+/// The table itself is protected by a mutex, and sessions are shared,
+/// so the lock is only held to look up, add or remove a session.
+/// The trace loggers are created and destroyed without holding it.
+class session_table
+{
+    using steady_clock = std::chrono::steady_clock;
+
+public:
+    using shared_session = std::shared_ptr<peer_session>;
+
+    /// Creates a trace logger for a new session.
+    using logger_factory = std::function<std::unique_ptr<stats_logger>(const sockaddr_any& peer)>;
+
+    /// @param tsbpd_opts options of the TSBPD state of the sessions
+    session_table(size_t max_sessions, const tsbpd_options& tsbpd_opts, logger_factory make_logger)
+        : m_max_sessions(max_sessions)
+        , m_tsbpd_options(tsbpd_opts)
+        , m_make_logger(std::move(make_logger))
+    {
+    }
+
+    /// @returns The session of the peer or nullptr.
+    shared_session find(const sockaddr_any& peer) const;
+
+    /// Find the session of the peer or create a new one.
+    /// @param [out] created true if a new session was created.
+    /// @returns nullptr if the table is full.
+    shared_session find_or_create(const sockaddr_any& peer, bool remote, bool& created);
+
+    /// Copy the current sessions into @a out (the vector is reused to avoid allocations).
+    void snapshot(std::vector<shared_session>& out) const;
+
+    /// Remove remote-initiated sessions that have received nothing for longer than @a timeout.
+    /// @returns The number of removed sessions.
+    size_t evict_idle(const steady_clock::duration& timeout);
+
+    size_t size() const;
+
+private:
+    struct addr_less
+    {
+        bool operator()(const sockaddr_any& lhs, const sockaddr_any& rhs) const;
+    };
+
+    const size_t         m_max_sessions;
+    const tsbpd_options  m_tsbpd_options;
+    const logger_factory m_make_logger;
+
+    mutable std::mutex                                m_mtx;
+    std::map<sockaddr_any, shared_session, addr_less> m_sessions;
+
+    std::mutex m_create_mtx; // serializes the creation of sessions
+};
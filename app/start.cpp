@@ -5,8 +5,20 @@
 #include "utils.hpp"
 #include "path.hpp"
 #include "drift_tracer.hpp"
-#include "tsbpd.hpp"
+#include "tsbpd_dispatch.hpp"
 #include "stats_logger.hpp"
+#include "trace_sink.hpp"
+#include "session.hpp"
+#include "thread_sched.hpp"
+#include "periodic_timer.hpp"
+#include <filesystem>
+
+#if defined(__linux__)
+#include <poll.h>
+#endif
+
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include <fmt/ranges.h>
 
 #include "buf_view.hpp"
 #include "packet/pkt_base.hpp"
@@ -18,15 +30,10 @@ using namespace chrono;
 #define LOG_SC_RECV "[PATH] "
 
 using shared_udp = shared_ptr<socket_udp>;
+using shared_session = session_table::shared_session;
 
-mutex g_path_mut;
-path_metrics g_path;
 const auto g_start_time_std = steady_clock::now();
 const auto g_start_time_sys = system_clock::now();
-auto g_stats_time = steady_clock::now();
-tsbpd g_tsbpd;
-
-unique_ptr<stats_logger> g_stats_logger;
 
 unsigned int get_timestamp_std()
 {
@@ -38,64 +45,242 @@ unsigned int get_timestamp_sys()
     return (unsigned int)duration_cast<microseconds>(system_clock::now() - g_start_time_sys).count();
 }
 
-/// @brief Sends ACK packets every 10 ms
-/// @param sock_udp UDP socket to use for ACK sending
-/// @param force_break a flag to check in case app wants to close itself
-void ack_sending_loop(shared_udp sock_udp, const atomic_bool& force_break)
+/// Matches kernel TX timestamps read from the socket error queue to the ACK packets they belong to.
+/// The ACK record is stored with the user-space send time first and is updated if the kernel
+/// timestamp arrives before the ACKACK. Otherwise the user-space time is used for the RTT.
+class tx_timestamp_matcher
 {
-    const size_t mtu_size = 1500;
-    vector<unsigned char> buffer(mtu_size);
-    socket_udp& sock_dst = *sock_udp.get();
-    auto last_msg_time = steady_clock::now(); // Allows tracking "no remote IP" log message frequency.
+public:
+    void on_sent(uint32_t tskey, const shared_session& session, uint32_t ackno)
+    {
+        record& r = m_pending[tskey % m_pending.size()];
+        if (r.session)
+            ++m_missed;
+        r = { tskey, ackno, session };
+    }
 
-    spdlog::info(LOG_SC_RECV "SND Started");
+    /// Read all pending TX timestamps and update the corresponding ACK records.
+    void drain(socket_udp& sock)
+    {
+        uint32_t tskey = 0;
+        system_clock::time_point tx_time_sys;
+        while (sock.read_tx_timestamp(tskey, tx_time_sys))
+        {
+            record& r = m_pending[tskey % m_pending.size()];
+            if (!r.session || r.tskey != tskey)
+                continue;
+
+            // The kernel timestamp comes from the system clock. Map it onto the steady clock.
+            const auto now_std = steady_clock::now();
+            const auto now_sys = system_clock::now();
+            const auto tx_time_std = now_std - duration_cast<steady_clock::duration>(now_sys - tx_time_sys);
+
+            if (r.session->path.ack_records.update(r.ackno, tx_time_std, tx_time_sys))
+                ++m_received;
+            else
+                ++m_late;
+            r.session.reset();
+        }
+    }
 
-    unsigned int ackno = 1;
-    while (!force_break)
+    size_t received() const { return m_received; }
+    size_t late() const { return m_late; }
+    size_t missed() const { return m_missed; }
+
+private:
+    struct record
     {
-        this_thread::sleep_for(10ms);
+        uint32_t       tskey;
+        uint32_t       ackno;
+        shared_session session; // nullptr if no timestamp is expected
+    };
+
+    array<record, 1024> m_pending = {}; // enough for one tick of ACKs to many peers
+    size_t m_received = 0; // Timestamps applied to ACK records.
+    size_t m_late     = 0; // Timestamps that arrived after the ACKACK.
+    size_t m_missed   = 0; // Timestamps that were never delivered.
+};
+
+/// @brief Sends ACK packets every ACK interval (10 ms by default) to every known peer
+/// @details ACKs of one tick are sent to all peers in a single batch (sendmmsg).
+/// Ticks are scheduled on absolute deadlines, so the ACK period does not drift.
+/// The send time of an ACK is estimated within the duration of the batch call, unless kernel TX timestamps are enabled.
+class ack_sender
+{
+public:
+    /// @param sock_dst UDP socket to use for ACK sending
+    /// @param sessions peers to send ACKs to
+    /// @param tick_trace if not null, the wakeup lateness of every tick is written there
+    ack_sender(socket_udp& sock_dst, session_table& sessions, const config& cfg, ostream* tick_trace)
+        : m_sock(sock_dst)
+        , m_sessions(sessions)
+        , m_cfg(cfg)
+        , m_tick_trace(tick_trace)
+        , m_timer(microseconds(cfg.ack_interval_us))
+        , m_last_msg_time(steady_clock::now())
+    {
+        m_tx_timestamps = cfg.tx_timestamps && m_sock.enable_tx_timestamps();
+        if (cfg.tx_timestamps && !m_tx_timestamps)
+            spdlog::warn(LOG_SC_RECV "SND kernel TX timestamps are not available, using user-space send time.");
+
+        if (m_tick_trace)
+            *m_tick_trace << "usDeadline,usLateness,Missed\n";
+    }
+
+    periodic_timer& timer() { return m_timer; }
+
+    /// Send ACKs to all peers.
+    /// @param deadline the scheduled time of the tick
+    void on_tick(const steady_clock::time_point& deadline)
+    {
+        if (m_tick_trace)
+        {
+            *m_tick_trace << count_microseconds(deadline - g_start_time_std) << ","
+                << count_microseconds(m_timer.last_lateness()) << "," << m_timer.get_stats().missed << "\n";
+        }
+
+        if (m_cfg.peer_timeout_s > 0)
+            m_sessions.evict_idle(seconds(m_cfg.peer_timeout_s));
 
-        if (sock_dst.dst_addr().empty())
+        m_sessions.snapshot(m_peers);
+        if (m_peers.empty())
         {
             const auto tnow = steady_clock::now();
-            if (tnow - last_msg_time > 1s)
+            if (tnow - m_last_msg_time > 1s)
             {
                 spdlog::warn(LOG_SC_RECV "SND: don't know remote yet, waiting for incoming ACK.");
-                last_msg_time = tnow;
+                m_last_msg_time = tnow;
             }
-            continue;
+            return;
         }
 
-        fill(buffer.begin(), buffer.end(), 0);
-        pkt_ack<mut_bufv> pkt(mut_bufv(buffer.data(), buffer.size()));
-        pkt.control_type(ctrl_type::ACK);
-        pkt.timestamp(get_timestamp_std());
-        pkt.ackno(ackno++);
+        m_buffer.assign(m_peers.size() * ack_slot_size, 0);
+        m_dst_addrs.clear();
+        m_packets.clear();
+        m_tskeys.assign(m_tx_timestamps ? m_peers.size() : 0, 0);
+        m_send_errors.assign(m_peers.size(), 0);
+
+        for (size_t i = 0; i < m_peers.size(); ++i)
+        {
+            peer_session& peer = *m_peers[i];
+            pkt_ack<mut_bufv> pkt(mut_bufv(m_buffer.data() + i * ack_slot_size, ack_slot_size));
+            pkt.control_type(ctrl_type::ACK);
+            pkt.timestamp(get_timestamp_std());
+            pkt.ackno(peer.ackno++);
+
+            const path_metrics::rtt_snapshot rtt = peer.path.published_rtt();
+            if (rtt.rtt != 0)
+            {
+                pkt.rtt(rtt.rtt);
+                pkt.rttvar(rtt.rtt_var);
+            }
+
+            m_dst_addrs.push_back(peer.peer_addr);
+            m_packets.push_back(pkt.const_buf());
+        }
+
+        // The records are stored before sending: with a short round trip the ACKACK of a peer early in the batch
+        // can be received while the call is still sending to the others.
+        const auto call_start_std = steady_clock::now();
+        const auto call_start_sys = system_clock::now();
+        for (size_t i = 0; i < m_peers.size(); ++i)
+            m_peers[i]->path.ack_records.store(pkt_ack<const_bufv>(m_packets[i]).ackno(), call_start_std, call_start_sys);
+
+        // The datagrams that failed are logged by the socket. Their records stay unacknowledged.
+        m_sock.sendmmsg(buf_view<const sockaddr_any>(m_dst_addrs.data(), m_dst_addrs.size()),
+            buf_view<const const_bufv>(m_packets.data(), m_packets.size()), buf_view<int>(m_send_errors.data(), m_send_errors.size()),
+            buf_view<uint32_t>(m_tskeys.data(), m_tskeys.size()));
+        const auto call_duration = steady_clock::now() - call_start_std;
 
-        g_path_mut.lock();
-        if (g_path.rtt != 0)
+        for (size_t i = 0; i < m_peers.size(); ++i)
         {
-            pkt.rtt(g_path.rtt);
-            pkt.rttvar(g_path.rtt_var);
+            if (m_send_errors[i] != 0)
+                continue;
+
+            // The datagrams of the batch leave one after another during the call. Taking the start of the call
+            // for all of them would make the last ones early (and their RTT long) by up to the call duration,
+            // so the call duration is spread evenly over the batch. The record is left as is if its ACKACK
+            // has already been received. Kernel TX timestamps replace the estimate.
+            const auto sent_after = call_duration * static_cast<int64_t>(i + 1) / static_cast<int64_t>(m_peers.size());
+            peer_session& peer = *m_peers[i];
+            const pkt_ack<const_bufv> pkt(m_packets[i]);
+            peer.path.ack_records.update(pkt.ackno(), call_start_std + sent_after,
+                call_start_sys + duration_cast<system_clock::duration>(sent_after));
+
+            if (m_tx_timestamps)
+                m_tx_matcher.on_sent(m_tskeys[i], m_peers[i], pkt.ackno());
         }
-        g_path_mut.unlock();
 
-        const int bytes_sent = sock_dst.send(pkt.const_buf());
-        const auto send_time_std = steady_clock::now(); // record time as close to sending as possible
-        const auto send_time_sys = system_clock::now();
+        // A software TX timestamp is usually available by the time the send call returns.
+        // Late ones are picked up after the next tick, or by read_tx_timestamps() in the reactor.
+        read_tx_timestamps();
+    }
+
+    /// Read the TX timestamps pending in the error queue of the socket.
+    void read_tx_timestamps()
+    {
+        if (m_tx_timestamps)
+            m_tx_matcher.drain(m_sock);
+    }
 
-        if (bytes_sent != pkt.length())
+    /// Log the summary of TX timestamps and ticks.
+    void report() const
+    {
+        if (m_tx_timestamps)
         {
-            spdlog::warn("SND send returned {} bytes, expected {}", bytes_sent, pkt.length());
-            continue;
+            spdlog::info(LOG_SC_RECV "SND kernel TX timestamps: {} applied, {} late, {} missed.",
+                m_tx_matcher.received(), m_tx_matcher.late(), m_tx_matcher.missed());
         }
 
-        lock_guard<mutex> lck(g_path_mut);
-        g_path.ack_records.store(pkt.ackno(), pkt.ackseqno(), send_time_std, send_time_sys);
+        const periodic_timer::stats& ticks = m_timer.get_stats();
+        if (ticks.ticks > 0)
+        {
+            spdlog::info(LOG_SC_RECV "SND {} ticks of {} us, {} missed. Wakeup lateness: avg {} us, max {} us.",
+                ticks.ticks, m_cfg.ack_interval_us, ticks.missed, count_microseconds(ticks.lateness_sum) / (long long) ticks.ticks,
+                count_microseconds(ticks.lateness_max));
+        }
     }
+
+private:
+    static constexpr size_t ack_slot_size = 64; // ACK packet is 44 bytes
+
+    socket_udp&    m_sock;
+    session_table& m_sessions;
+    const config&  m_cfg;
+    ostream* const m_tick_trace;
+    periodic_timer m_timer;
+    bool           m_tx_timestamps = false;
+    tx_timestamp_matcher     m_tx_matcher;
+    steady_clock::time_point m_last_msg_time; // Allows tracking "no remote IP" log message frequency.
+
+    // Reused every tick, so there are no allocations once the number of peers settles.
+    vector<unsigned char>  m_buffer;
+    vector<shared_session> m_peers;
+    vector<sockaddr_any>   m_dst_addrs;
+    vector<const_bufv>     m_packets;
+    vector<uint32_t>       m_tskeys;
+    vector<int>            m_send_errors;
+};
+
+/// @brief Sends ACK packets to every known peer on the ticks of the ACK timer
+/// @param sock_udp UDP socket to use for ACK sending
+/// @param sessions peers to send ACKs to
+/// @param force_break a flag to check in case app wants to close itself
+/// @param tick_trace if not null, the wakeup lateness of every tick is written there
+void ack_sending_loop(shared_udp sock_udp, session_table& sessions, const atomic_bool& force_break, const config& cfg,
+    ostream* tick_trace)
+{
+    ack_sender sender(*sock_udp, sessions, cfg, tick_trace);
+
+    spdlog::info(LOG_SC_RECV "SND Started");
+
+    while (!force_break)
+        sender.on_tick(sender.timer().wait());
+
+    sender.report();
 }
 
-void on_ctrl_ack(pkt_ack<const_bufv> ackpkt, socket_udp& sock_udp)
+void on_ctrl_ack(pkt_ack<const_bufv> ackpkt, socket_udp& sock_udp, const sockaddr_any& peer_addr)
 {
     array<unsigned char, 40> buffer = {};
     pkt_ackack<mut_bufv> pkt(mut_bufv(buffer.data(), buffer.size()));
@@ -106,105 +291,384 @@ void on_ctrl_ack(pkt_ack<const_bufv> ackpkt, socket_udp& sock_udp)
 
     // TODO: Extract RTT and RTTVar
 
-    const int bytes_sent = sock_udp.send(pkt.const_buf());
+    const int bytes_sent = sock_udp.sendto(peer_addr, pkt.const_buf());
 }
 
-void on_ctrl_ackack(pkt_ackack<const_bufv> ackpkt, const steady_clock::time_point& recv_time_std, const system_clock::time_point& recv_time_sys, const config& cfg)
+/// @param recv_time_std time of ACKACK reception (kernel timestamp mapped to steady clock if available)
+/// @param recv_time_sys time of ACKACK reception (kernel timestamp if available)
+/// @param user_time_std time ACKACK was read by the application (steady clock)
+void on_ctrl_ackack(pkt_ackack<const_bufv> ackpkt, peer_session& peer, const steady_clock::time_point& recv_time_std,
+    const system_clock::time_point& recv_time_sys, const steady_clock::time_point& user_time_std)
 {
-    lock_guard<mutex> lck(g_path_mut);
-    const auto rtt_pair = g_path.ack_records.acknowledge(ackpkt.ackno(), recv_time_std, recv_time_sys);
+    path_metrics& path = peer.path;
+    const auto rtt_pair = path.ack_records.acknowledge(ackpkt.ackno(), recv_time_std, recv_time_sys);
 
-    // TODO: rtt_pair can return -1
-    if (g_path.rtt == 0)
+    // A duplicate, reordered or overwritten ACKACK has no ACK record, so there is no RTT to take
+    // and the drift sample cannot be compensated or filtered by RTT.
+    if (rtt_pair.rtt_std < 0)
     {
-        g_path.rtt = rtt_pair.rtt_std;
-        g_path.rtt_var = rtt_pair.rtt_std / 2;
+        ++path.invalid_ackacks;
+        spdlog::debug(LOG_SC_RECV "{}: no ACK record for ACKACK {}, ignored ({} in total).", peer.peer_addr.str(),
+            ackpkt.ackno(), path.invalid_ackacks);
+        return;
+    }
+
+    // The drift sample filter compares the sample with the RTT before it.
+    const rtt_sample rtt = {rtt_pair.rtt_std, path.rtt, path.rtt_var};
+
+    if (path.rtt == 0)
+    {
+        path.rtt = rtt_pair.rtt_std;
+        path.rtt_var = rtt_pair.rtt_std / 2;
     }
     else
     {
-        g_path.rtt_var = avg_rma<4, int>(g_path.rtt_var, abs(rtt_pair.rtt_std - g_path.rtt));
-        g_path.rtt = avg_rma<8>(g_path.rtt, rtt_pair.rtt_std);
+        path.rtt_var = avg_rma<4, int>(path.rtt_var, abs(rtt_pair.rtt_std - path.rtt));
+        path.rtt = avg_rma<8>(path.rtt, rtt_pair.rtt_std);
+    }
+    path.publish_rtt();
+
+    any_tsbpd& tsbpd_state = *peer.tsbpd_state;
+    const long long drift_sample = tsbpd_state.on_ackack(ackpkt.timestamp(), rtt, recv_time_std);
+
+    if (peer.stats)
+    {
+        peer.stats->trace(user_time_std - g_start_time_std, recv_time_sys - g_start_time_sys, recv_time_std - g_start_time_std,
+            ackpkt.timestamp(), ackpkt.timestamp_sys(),
+            rtt_pair.rtt_sys, rtt_pair.rtt_std, path.rtt, path.rtt_var, drift_sample,
+            tsbpd_state.drift(), tsbpd_state.overdrift(), tsbpd_state.get_pkt_time_base(ackpkt.timestamp()),
+            tsbpd_state.drift_estimate(), tsbpd_state.skew_ppm());
+    }
+    else if (steady_clock::now() > peer.stats_time)
+    {
+        // The uncertainty is known if the drift tracer models the clock (kalman).
+        if (tsbpd_state.drift_estimate_stddev() > 0)
+            spdlog::info("{}: Estimated RTT {}, RTT rma {}, RTT var {}, drift {} +- {:.1f} us, skew {:.3f} +- {:.3f} ppm",
+                peer.peer_addr.str(), rtt_pair.rtt_std, path.rtt, path.rtt_var, tsbpd_state.drift(),
+                tsbpd_state.drift_estimate_stddev(), tsbpd_state.skew_ppm(), tsbpd_state.skew_stddev_ppm());
+        else
+            spdlog::info("{}: Estimated RTT {}, RTT rma {}, RTT var {}, drift {}", peer.peer_addr.str(),
+                rtt_pair.rtt_std, path.rtt, path.rtt_var, tsbpd_state.drift());
+        peer.stats_time = steady_clock::now() + 1s;
+    }
+}
+
+/// @brief Handles a single ACK or ACKACK packet received from a peer.
+/// @param dgram datagram reception details
+/// @param user_time_std time the datagram was read by the application (steady clock)
+/// @param user_time_sys time the datagram was read by the application (system clock)
+/// @param last_msg_time allows tracking "too many peers" log message frequency
+void on_datagram(const const_bufv& pkt_buf, const datagram_info& dgram, const steady_clock::time_point& user_time_std,
+    const system_clock::time_point& user_time_sys, socket_udp& sock_src, session_table& sessions,
+    steady_clock::time_point& last_msg_time)
+{
+    const sockaddr_any& src_addr = dgram.src_addr;
+
+    // Prefer the kernel reception time. It comes from the system clock,
+    // so the steady clock time is derived from the delay it took to read the datagram.
+    auto recv_time_std = user_time_std;
+    auto recv_time_sys = user_time_sys;
+    if (dgram.kernel_time_sys != system_clock::time_point() && dgram.kernel_time_sys <= user_time_sys)
+    {
+        recv_time_sys = dgram.kernel_time_sys;
+        recv_time_std = user_time_std - duration_cast<steady_clock::duration>(user_time_sys - dgram.kernel_time_sys);
     }
 
-    const long long drift_sample = g_tsbpd.on_ackack(ackpkt.timestamp(), cfg.compensate_rtt ? rtt_pair.rtt_std : 0, recv_time_std);
+    if (pkt_buf.size() == 0)
+    {
+        spdlog::info(LOG_SC_RECV "RCV received 0 bytes on a socket (spurious read-ready?). Retrying.");
+        return;
+    }
 
-    if (g_stats_logger)
+    pkt_base<const_bufv> pkt(pkt_buf);
+
+    if (!pkt.is_ctrl())
     {
-        g_stats_logger->trace(recv_time_std - g_start_time_std, recv_time_sys - g_start_time_sys, ackpkt.timestamp(), ackpkt.timestamp_sys(),
-            rtt_pair.rtt_sys, rtt_pair.rtt_std, g_path.rtt, g_path.rtt_var, drift_sample,
-            g_tsbpd.drift(), g_tsbpd.overdrift(), g_tsbpd.get_pkt_time_base(ackpkt.timestamp()));
+        spdlog::info(LOG_SC_RECV "RCV received unknown packet. Ignoring.");
+        return;
+    }
+
+    const auto ctrl_pkt_type = pkt.control_type();
+    if (ctrl_pkt_type == ctrl_type::ACK)
+    {
+        bool created = false;
+        const shared_session peer = sessions.find_or_create(src_addr, true, created);
+        if (!peer)
+        {
+            if (user_time_std - last_msg_time > 1s)
+            {
+                spdlog::warn(LOG_SC_RECV "RCV Got incoming ACK from {}, but the limit of peers is reached. Ignoring.",
+                    src_addr.str());
+                last_msg_time = user_time_std;
+            }
+            return;
+        }
+
+        if (created)
+            spdlog::info(LOG_SC_RECV "RCV Got incoming ACK, added target {}", src_addr.str());
+
+        peer->touch();
+        on_ctrl_ack(pkt, sock_src, src_addr);
     }
-    else if (steady_clock::now() > g_stats_time)
+    else if (ctrl_pkt_type == ctrl_type::ACKACK)
     {
-        spdlog::info("Estimated RTT {}, RTT rma {}, RTT var {}, drift {}", rtt_pair.rtt_std, g_path.rtt, g_path.rtt_var, g_tsbpd.drift());
-        g_stats_time = steady_clock::now() + 1s;
+        const shared_session peer = sessions.find(src_addr);
+        if (!peer)
+        {
+            spdlog::trace(LOG_SC_RECV "RCV Got ACKACK from unknown peer {}. Ignoring.", src_addr.str());
+            return;
+        }
+
+        peer->touch();
+        on_ctrl_ackack(pkt, *peer, recv_time_std, recv_time_sys, user_time_std);
     }
 }
 
-/// @brief Receives packets from data receiver and forwards them over multiple links to data sender.
+/// @brief Receives ACK and ACKACK packets from peers and dispatches them to peer sessions.
+/// @details Bursts of datagrams are drained in one call (recvmmsg).
+class ack_receiver
+{
+public:
+    /// @param sock_src source UDP socket
+    /// @param sessions peer sessions
+    ack_receiver(socket_udp& sock_src, session_table& sessions)
+        : m_sock(sock_src)
+        , m_sessions(sessions)
+        , m_buffer(mtu_size * socket_udp::max_batch)
+        , m_dgrams(socket_udp::max_batch)
+    {
+        for (size_t i = 0; i < socket_udp::max_batch; ++i)
+            m_buffers.emplace_back(m_buffer.data() + i * mtu_size, mtu_size);
+    }
+
+    /// Receive and handle a burst of datagrams.
+    /// @param timeout_ms how long to wait for a datagram (-1 - no limit)
+    /// @returns The number of datagrams received.
+    size_t receive(int timeout_ms)
+    {
+        const size_t num_read = m_sock.recvmmsg(buf_view<const mut_bufv>(m_buffers.data(), m_buffers.size()),
+            buf_view<datagram_info>(m_dgrams.data(), m_dgrams.size()), timeout_ms);
+        const auto user_time_std = steady_clock::now();
+        const auto user_time_sys = system_clock::now();
+
+        for (size_t i = 0; i < num_read; ++i)
+        {
+            const const_bufv pkt_buf(m_buffers[i].data(), m_dgrams[i].bytes);
+            on_datagram(pkt_buf, m_dgrams[i], user_time_std, user_time_sys, m_sock, m_sessions, m_last_msg_time);
+        }
+
+        return num_read;
+    }
+
+private:
+    static constexpr size_t mtu_size = 1500;
+
+    socket_udp&           m_sock;
+    session_table&        m_sessions;
+    vector<unsigned char> m_buffer;
+    vector<mut_bufv>      m_buffers;
+    vector<datagram_info> m_dgrams;
+    steady_clock::time_point m_last_msg_time; // Allows tracking "too many peers" log message frequency.
+};
+
+/// @brief Receives ACK and ACKACK packets from peers until the app closes.
 /// @param src source UDP socket
+/// @param sessions peer sessions
 /// @param force_break a flag to break the loop and return from the function
-void ack_reply_loop(shared_udp src, const atomic_bool& force_break, const config& cfg)
+void ack_reply_loop(shared_udp src, session_table& sessions, const atomic_bool& force_break, const config& cfg)
 {
-    const size_t mtu_size = 1500;
-    vector<unsigned char> buffer(mtu_size);
-
-    socket_udp& sock_src = *src.get();
+    ack_receiver receiver(*src, sessions);
 
     spdlog::info(LOG_SC_RECV "RCV Started");
 
     while (!force_break)
-    {
-        // TODO: Save timepoint as close to packet reception as possible
-        const auto [bytes_read, src_addr] = sock_src.recvfrom(mut_bufv(buffer.data(), buffer.size()), -1);
-        const auto recv_time_std = steady_clock::now();
-        const auto recv_time_sys = system_clock::now();
+        receiver.receive(cfg.rcv_timeout_ms);
+}
+
+/// @brief Sends ACKs and handles the replies from a single thread.
+/// @details One event loop waits for both the ACK timer and the socket, and runs the handlers inline.
+/// Compared to a thread per direction, there are fewer wakeups and no cross-thread access to the peer state.
+/// @param tick_trace if not null, the wakeup lateness of every tick is written there
+void reactor_loop(shared_udp sock_udp, session_table& sessions, const atomic_bool& force_break, const config& cfg,
+    ostream* tick_trace)
+{
+#if defined(__linux__)
+    ack_sender   sender(*sock_udp, sessions, cfg, tick_trace);
+    ack_receiver receiver(*sock_udp, sessions);
+
+    pollfd fds[2] = {};
+    fds[0].fd     = sender.timer().fd();
+    fds[0].events = POLLIN;
+    fds[1].fd     = sock_udp->rx_event_fd();
+    fds[1].events = POLLIN;
+
+    spdlog::info(LOG_SC_RECV "Reactor Started");
 
-        if (bytes_read == 0)
+    while (!force_break)
+    {
+        const int res = ::poll(fds, 2, cfg.rcv_timeout_ms);
+        if (res < 0 && errno != EINTR)
         {
-            spdlog::info(LOG_SC_RECV "RCV received 0 bytes on a socket (spurious read-ready?). Retrying.");
-            continue;
+            spdlog::error(LOG_SC_RECV "Reactor: poll failed, error {}.", errno);
+            break;
         }
 
-        const_bufv pkt_buf(buffer.data(), bytes_read);
-        pkt_base<const_bufv> pkt(pkt_buf);
-
-        if (!pkt.is_ctrl())
+        // The timer goes first to keep the ACK cadence.
+        if (fds[0].revents & POLLIN)
         {
-            spdlog::info(LOG_SC_RECV "RCV received unknown packet. Ignoring.");
-            continue;
+            const auto deadline = sender.timer().on_expired();
+            if (deadline != steady_clock::time_point())
+                sender.on_tick(deadline);
         }
 
-        const auto ctrl_pkt_type = pkt.control_type();
-        if (ctrl_pkt_type == ctrl_type::ACK)
+        if (fds[1].revents & POLLIN)
         {
-            if (sock_src.dst_addr().empty())
+            // Drain everything that is pending, a full batch means there may be more.
+            while (receiver.receive(0) == socket_udp::max_batch)
             {
-                sock_src.set_dst_addr(src_addr);
-                spdlog::info(LOG_SC_RECV "RCV Got incoming ACK, set target to {}", src_addr.str());
             }
-    
-            on_ctrl_ack(pkt, sock_src);
         }
-        else if (ctrl_pkt_type == ctrl_type::ACKACK)
+
+        // poll() keeps reporting POLLERR while the error queue is not empty or a socket error is pending,
+        // so a TX timestamp that arrives after the tick would make the loop spin until the next tick.
+        if (fds[1].revents & POLLERR)
         {
-            on_ctrl_ackack(pkt, recv_time_std, recv_time_sys, cfg);
+            sender.read_tx_timestamps();
+            // A pending socket error (e.g. ICMP port unreachable) is cleared by a read.
+            if (!(fds[1].revents & POLLIN))
+                receiver.receive(0);
         }
     }
+
+    sender.report();
+#else
+    spdlog::warn(LOG_SC_RECV "Reactor mode is not supported on this platform. Using separate threads.");
+    future<void> fb_route = ::async(::launch::async, ack_reply_loop, sock_udp, ref(sessions), ref(force_break), ref(cfg));
+    ack_sending_loop(sock_udp, sessions, force_break, cfg, tick_trace);
+    fb_route.wait();
+#endif
 }
 
-shared_udp create_socket(const string& url_str)
+shared_udp create_socket(const string& url_str, bool reuse_port)
 {
-    const UriParser url(url_str);
+    UriParser url(url_str);
 
     if (url.proto() == "udp")
     {
+        if (reuse_port)
+            url["reuseport"] = "yes";
         return make_shared<socket_udp>(url);
     }
 
     return nullptr;
 }
 
+/// A socket with its own peer sessions, reply loop and ACK sender (or a reactor doing both).
+/// Several workers bind to the same port (SO_REUSEPORT). The kernel hashes the address of a peer
+/// to pick the socket, so all packets of a peer land on the same worker and the workers share no state.
+struct worker
+{
+    shared_udp                sock;
+    unique_ptr<session_table> sessions;
+    thread_tuning             sender_tuning;   // also used for the reactor thread
+    thread_tuning             receiver_tuning;
+    unique_ptr<ofstream>      tick_trace;
+};
+
+void run_worker(worker& w, const atomic_bool& force_break, const config& cfg)
+{
+    if (cfg.reactor)
+    {
+        tune_this_thread(w.sender_tuning, "Reactor");
+        reactor_loop(w.sock, *w.sessions, force_break, cfg, w.tick_trace.get());
+        return;
+    }
+
+    future<void> fb_route = ::async(::launch::async, [&w, &force_break, &cfg]() {
+        tune_this_thread(w.receiver_tuning, "RCV");
+        ack_reply_loop(w.sock, *w.sessions, force_break, cfg);
+    });
+
+    tune_this_thread(w.sender_tuning, "SND");
+    ack_sending_loop(w.sock, *w.sessions, force_break, cfg, w.tick_trace.get());
+
+    fb_route.wait();
+}
+
+/// Description of the tracing configuration stored in the header of a binary trace.
+static string trace_config(const config& cfg, const sockaddr_any& peer)
+{
+    return fmt::format("peer={};ack_interval_us={};compensate_rtt={};sample_filter={};drift_tracer={};max_span={};"
+        "max_drift={};tx_timestamps={}", peer.str(), cfg.ack_interval_us, cfg.compensate_rtt, cfg.sample_filter,
+        cfg.drift_tracer, cfg.max_span, cfg.max_drift, cfg.tx_timestamps);
+}
+
+/// Name of the trace file of a peer. With a single peer the file name is used as is,
+/// otherwise the peer address is appended to the name, e.g. "trace-10.0.0.1_4200.csv".
+static string peer_trace_filename(const string& filename, const sockaddr_any& peer, const config& cfg)
+{
+    if (cfg.max_peers <= 1 && cfg.workers <= 1)
+        return filename;
+
+    string suffix = peer.str();
+    replace_if(suffix.begin(), suffix.end(), [](char c) { return c == ':' || c == '/' || c == '\\'; }, '_');
+
+    const size_t dot = filename.find_last_of('.');
+    const size_t sep = filename.find_last_of("/\\");
+    if (dot == string::npos || (sep != string::npos && dot < sep))
+        return filename + "-" + suffix;
+
+    return filename.substr(0, dot) + "-" + suffix + filename.substr(dot);
+}
+
+/// Open the trace file of a peer. The file is continued if it already exists,
+/// e.g. when the peer comes back after its session was closed.
+static unique_ptr<trace_sink> open_peer_trace_file(const string& filename, const trace_options& options)
+{
+    error_code ec;
+    const bool append = filesystem::exists(filename, ec);
+    return make_unique<trace_file_sink>(filename, options, append);
+}
+
+static trace_format parse_trace_format(const string& format)
+{
+    return format == "binary" ? trace_format::binary
+        : format == "archive" ? trace_format::archive : trace_format::csv;
+}
+
+/// Create a trace sink of a peer from its description (see --trace-sink).
+/// @param options the options of the trace file, used by the file sinks
+/// @throws std::runtime_error if the sink can't be opened.
+static unique_ptr<trace_sink> make_trace_sink(const string& spec, trace_options options, const sockaddr_any& peer,
+    const config& cfg)
+{
+    const size_t colon  = spec.find(':');
+    const string kind   = spec.substr(0, colon);
+    const string target = colon == string::npos ? string() : spec.substr(colon + 1);
+    if (kind == "ndjson")
+        return make_unique<ndjson_sink>(peer.str());
+    if (kind == "unix")
+        return make_unique<unix_socket_sink>(target, peer.str());
+
+    // The flight recorder applies to the --tracefile only.
+    options.format = parse_trace_format(kind);
+    options.flight_recorder_size = 0;
+    return open_peer_trace_file(peer_trace_filename(target, peer, cfg), options);
+}
+
+/// Validates the description of a trace sink (see --trace-sink).
+/// @returns An error message, or an empty string if the description is valid.
+static string check_trace_sink(const string& spec)
+{
+    const size_t colon = spec.find(':');
+    const string kind  = spec.substr(0, colon);
+    if (kind == "ndjson" && colon == string::npos)
+        return string();
+    if ((kind == "unix" || kind == "csv" || kind == "binary" || kind == "archive")
+        && colon != string::npos && colon + 1 < spec.size())
+        return string();
+    return "Invalid trace sink " + spec + ", expected ndjson, unix:PATH, csv:FILE, binary:FILE or archive:FILE";
+}
 
 void run(const string& sock_url,
     const config& cfg, const atomic_bool& force_break)
@@ -215,31 +679,150 @@ void run(const string& sock_url,
         return;
     }
 
-    // 2. Create UDP socket
-    shared_udp sock_udp = create_socket(sock_url);
-    if (!sock_udp)
+    // The standard output is taken by the trace rows.
+    if (find(cfg.trace_sinks.begin(), cfg.trace_sinks.end(), "ndjson") != cfg.trace_sinks.end())
+    {
+        auto logger = make_shared<spdlog::logger>("", make_shared<spdlog::sinks::stderr_color_sink_mt>());
+        logger->set_level(spdlog::default_logger()->level());
+        spdlog::set_default_logger(logger);
+    }
+
+    const bool listener = UriParser(sock_url).host().empty();
+    if (cfg.ack_interval_us <= 0)
+    {
+        spdlog::error(LOG_SC_RECV "ACK interval must be positive");
+        return;
+    }
+
+    // The drift tracer is specialized for the MAX_SPAN and MAX_DRIFT values at compile time.
+    tsbpd_options tsbpd_opts;
+    tsbpd_opts.compensate_rtt = cfg.compensate_rtt;
+    tsbpd_opts.filter         = parse_drift_filter(cfg.sample_filter);
+    tsbpd_opts.drift_tracer   = parse_drift_tracer(cfg.drift_tracer);
+    tsbpd_opts.max_span       = cfg.max_span;
+    tsbpd_opts.max_drift      = cfg.max_drift;
+    const string tracer_error = check_drift_tracer(tsbpd_opts.drift_tracer, cfg.max_span, cfg.max_drift);
+    if (!tracer_error.empty())
     {
-        spdlog::error(LOG_SC_RECV "Target creation failed!");
+        spdlog::error(LOG_SC_RECV "{}", tracer_error);
         return;
     }
+    if (tsbpd_opts.drift_tracer == drift_tracer_kind::kalman)
+        spdlog::info(LOG_SC_RECV "Drift tracer kalman, MAX_DRIFT {} us.", cfg.max_drift);
+    else
+        spdlog::info(LOG_SC_RECV "Drift tracer {}, MAX_SPAN {}, MAX_DRIFT {} us.", cfg.drift_tracer, cfg.max_span, cfg.max_drift);
 
-    if (!cfg.statsfile.empty())
+    size_t num_workers = max(cfg.workers, 1);
+    if (num_workers > 1 && !listener)
     {
-        try {
-            g_stats_logger = make_unique<stats_logger>(cfg.statsfile, cfg.compact_trace);
-        }
-        catch (const runtime_error& e)
+        // Replies from the remote peer may be hashed to any of the sockets.
+        spdlog::warn(LOG_SC_RECV "Several workers require a listener URI (no remote host). Using one worker.");
+        num_workers = 1;
+    }
+
+    // Held until the workers and their sessions are gone, so the writer thread is stopped (and the last rows
+    // are written) here and not by the reply loop or the ACK sender releasing the last session.
+    const bool tracing = !cfg.statsfile.empty() || !cfg.trace_sinks.empty();
+    const shared_ptr<trace_writer> writer = tracing ? trace_writer::acquire() : nullptr;
+
+    // 2. Create UDP sockets
+    vector<worker> workers(num_workers);
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        workers[i].sock = create_socket(sock_url, num_workers > 1);
+        if (!workers[i].sock)
         {
-            spdlog::error(e.what());
+            spdlog::error(LOG_SC_RECV "Target creation failed!");
             return;
         }
+
+        // Thread-specific CPU lists take precedence over the worker ones.
+        const auto pick_cpu = [i, &cfg](const vector<int>& cpus) {
+            if (!cpus.empty())
+                return cpus[i % cpus.size()];
+            if (!cfg.worker_cpus.empty())
+                return cfg.worker_cpus[i % cfg.worker_cpus.size()];
+            return -1;
+        };
+
+        workers[i].sender_tuning.cpu               = pick_cpu(cfg.sender_cpus);
+        workers[i].sender_tuning.fifo_priority     = cfg.fifo_priority;
+        workers[i].sender_tuning.min_timer_slack   = cfg.min_timer_slack;
+        workers[i].receiver_tuning.cpu             = pick_cpu(cfg.receiver_cpus);
+        workers[i].receiver_tuning.fifo_priority   = cfg.fifo_priority;
+        workers[i].receiver_tuning.min_timer_slack = cfg.min_timer_slack;
+
+        if (!cfg.tick_trace.empty())
+        {
+            const string filename = num_workers > 1 ? cfg.tick_trace + "-" + to_string(i) : cfg.tick_trace;
+            workers[i].tick_trace = make_unique<ofstream>(filename);
+            if (!*workers[i].tick_trace)
+            {
+                spdlog::error(LOG_SC_RECV "Failed to open {}", filename);
+                return;
+            }
+        }
     }
 
-    future<void> fb_route = ::async(::launch::async, ack_reply_loop, sock_udp, ref(force_break), ref(cfg));
+    session_table::logger_factory make_logger;
+    if (tracing)
+    {
+        trace_options options;
+        options.format = parse_trace_format(cfg.trace_format);
+        options.compact_mode = cfg.compact_trace;
+        options.flight_recorder_size = cfg.flight_recorder_size;
+        options.rotate_size = cfg.trace_rotate_size;
+        options.rotate_interval = chrono::seconds(cfg.trace_rotate_interval_s);
+        make_logger = [&cfg, options](const sockaddr_any& peer) -> unique_ptr<stats_logger> {
+            try {
+                trace_options peer_options = options;
+                peer_options.config = trace_config(cfg, peer);
+
+                vector<unique_ptr<trace_sink>> sinks;
+                if (!cfg.statsfile.empty())
+                    sinks.push_back(open_peer_trace_file(peer_trace_filename(cfg.statsfile, peer, cfg), peer_options));
+                for (const string& spec : cfg.trace_sinks)
+                    sinks.push_back(make_trace_sink(spec, peer_options, peer, cfg));
+
+                return make_unique<stats_logger>(peer.str(), move(sinks));
+            }
+            catch (const runtime_error& e)
+            {
+                spdlog::error(e.what());
+                return nullptr;
+            }
+        };
+    }
 
-    ack_sending_loop(sock_udp, force_break);
+    // The limit of peers applies to each worker, as the kernel does not balance peers evenly.
+    for (worker& w : workers)
+        w.sessions = make_unique<session_table>(max(cfg.max_peers, 1), tsbpd_opts, make_logger);
 
-    fb_route.wait();
+    // The remote peer is known: start sending ACKs to it right away.
+    const shared_udp& sock_udp = workers[0].sock;
+    if (!sock_udp->dst_addr().empty())
+    {
+        bool created = false;
+        const shared_session peer = workers[0].sessions->find_or_create(sock_udp->dst_addr(), false, created);
+        if (tracing && !peer->stats)
+            return;
+    }
+
+    // After the sockets and files are open, so that their memory is locked too.
+    if (cfg.lock_memory)
+        lock_memory(256 * 1024);
+
+    if (num_workers > 1)
+        spdlog::info(LOG_SC_RECV "Started {} workers.", num_workers);
+
+    vector<future<void>> fb_workers;
+    for (size_t i = 1; i < num_workers; ++i)
+        fb_workers.push_back(::async(::launch::async, run_worker, ref(workers[i]), ref(force_break), ref(cfg)));
+
+    run_worker(workers[0], force_break, cfg);
+
+    for (auto& fb : fb_workers)
+        fb.wait();
 }
 
 CLI::App* add_subcommand(CLI::App& app, config& cfg, string& sock_url)
@@ -248,8 +831,54 @@ CLI::App* add_subcommand(CLI::App& app, config& cfg, string& sock_url)
     sc_route->add_option("sock_url", sock_url, "Source URI")->expected(1);
     sc_route->add_option("--tracefile", cfg.statsfile, "Trace output file");
     sc_route->add_flag("--compensate-rtt", cfg.compensate_rtt, "Compensate RTT variations in drift tracing");
+    sc_route->add_option("--sample-filter", cfg.sample_filter,
+        "Drift samples passed to the drift tracer: off, min-rtt (the lowest RTT of every 8 samples) "
+        "or rtt-gate (drop samples above SRTT + 4 * RTTVar, weight the rest by the RTT deviation)")
+        ->check(CLI::IsMember({"off", "min-rtt", "rtt-gate"}));
+    sc_route->add_option("--drift-tracer", cfg.drift_tracer,
+        "Drift tracer: mean (of blocks of MAX_SPAN samples, as in SRT), median (sliding over MAX_SPAN samples) "
+        "or kalman (clock model)")
+        ->check(CLI::IsMember({"mean", "median", "kalman"}));
+    sc_route->add_option("--max-span", cfg.max_span,
+        fmt::format("Number of drift samples to average the drift over (MAX_SPAN): {}", fmt::join(tsbpd_max_spans, ", ")));
+    sc_route->add_option("--max-drift", cfg.max_drift,
+        fmt::format("Drift (us) to shift the time base at (MAX_DRIFT): {}", fmt::join(tsbpd_max_drifts, ", ")));
+    sc_route->add_option("--trace-format", cfg.trace_format,
+        "Trace file format: csv, binary (fixed-width records with a time index) or archive (compressed)")
+        ->check(CLI::IsMember({"csv", "binary", "archive"}));
+    sc_route->add_option("--trace-rotate-size", cfg.trace_rotate_size,
+        "Start a new trace file when the current one reaches this size (e.g. 1GB), compressing the closed one")
+        ->transform(CLI::AsSizeValue(false));
+    sc_route->add_option("--trace-rotate-interval", cfg.trace_rotate_interval_s,
+        "Start a new trace file every this many seconds, compressing the closed one");
+    sc_route->add_option("--flight-recorder", cfg.flight_recorder_size,
+        "Keep only the latest trace rows in a circular file of this size (e.g. 64MB), "
+        "saving the rows around RTT spikes and TSBPD shifts to separate files")
+        ->transform(CLI::AsSizeValue(false));
+    sc_route->add_option("--trace-sink", cfg.trace_sinks,
+        "More outputs of the trace rows: ndjson (standard output), unix:PATH (datagram socket), "
+        "csv:FILE, binary:FILE or archive:FILE. Can be repeated")
+        ->check(check_trace_sink);
     sc_route->add_flag("--compact-trace", cfg.compact_trace, "Write compact trace file without drift correction artifacts");
+    sc_route->add_flag("--tx-timestamps", cfg.tx_timestamps, "Use kernel TX timestamps as ACK send time");
+    sc_route->add_option("--rcv-timeout", cfg.rcv_timeout_ms, "Receiving wait timeout, ms (-1 to block)");
+    sc_route->add_option("--max-peers", cfg.max_peers, "Maximum number of peers to trace (one trace file per peer)");
+    sc_route->add_option("--peer-timeout", cfg.peer_timeout_s, "Close a session with a peer that has been silent for this many seconds (0 - never)");
+    sc_route->add_option("--ack-interval", cfg.ack_interval_us, "ACK sending interval, us");
+    sc_route->add_option("--tick-trace", cfg.tick_trace, "Write the wakeup lateness of every ACK tick to a file");
+    sc_route->add_flag("--reactor", cfg.reactor, "Send ACKs and handle replies from one thread per worker");
+    sc_route->add_option("--workers", cfg.workers, "Number of sockets sharing the port (SO_REUSEPORT), each with its own threads and peers");
+    sc_route->add_option("--worker-cpus", cfg.worker_cpus, "Comma-separated CPU cores to pin the workers to")->delimiter(',')
+        ->group("Low jitter");
+    sc_route->add_option("--sender-cpus", cfg.sender_cpus, "Comma-separated CPU cores to pin the ACK sender threads to")
+        ->delimiter(',')->group("Low jitter");
+    sc_route->add_option("--receiver-cpus", cfg.receiver_cpus, "Comma-separated CPU cores to pin the reply loop threads to")
+        ->delimiter(',')->group("Low jitter");
+    sc_route->add_option("--fifo-priority", cfg.fifo_priority, "Run the sender and receiver threads with SCHED_FIFO of this priority (1..99)")
+        ->group("Low jitter");
+    sc_route->add_flag("--lock-memory", cfg.lock_memory, "Lock and pre-fault memory (mlockall)")->group("Low jitter");
+    sc_route->add_flag("--min-timer-slack", cfg.min_timer_slack, "Set the timer slack of the sender and receiver threads to 1 ns")
+        ->group("Low jitter");
 
     return sc_route;
 }
-
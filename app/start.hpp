@@ -1,5 +1,6 @@
 #pragma once
 #include "stdafx.hpp"
+#include <vector>
 
 // Third party libraries
 #include "CLI/CLI.hpp"
@@ -8,9 +9,32 @@
 struct config
 {
     int message_size = 1456;
+    int rcv_timeout_ms  = 100;   // how long the reply loop blocks on the socket before checking for exit
+    int max_peers       = 1;     // maximum number of peer sessions on one socket
+    int peer_timeout_s  = 0;     // close idle remote-initiated sessions after this time (0 - never)
+    int ack_interval_us = 10000; // ACK sending period
+    int workers         = 1;     // number of sockets sharing the port (SO_REUSEPORT), each with its own threads and sessions
+    int fifo_priority   = 0;     // SCHED_FIFO priority of the sender and receiver threads, 0 - default policy
+    std::vector<int> worker_cpus;   // CPU cores to pin the threads of each worker to (round-robin), empty - no pinning
+    std::vector<int> sender_cpus;   // CPU cores to pin the ACK sender threads to, overrides worker_cpus
+    std::vector<int> receiver_cpus; // CPU cores to pin the reply loop threads to, overrides worker_cpus
     bool compensate_rtt = false;
+    std::string sample_filter = "off"; // drift samples passed to the drift tracer: off, min-rtt or rtt-gate
+    std::string drift_tracer = "mean"; // mean, median or kalman
+    unsigned max_span        = 1000;   // MAX_SPAN of the drift tracer (samples), not used by kalman
+    int max_drift            = 5000;   // MAX_DRIFT of the drift tracer (us)
     bool compact_trace  = false;
+    bool tx_timestamps  = false; // take ACK send time from kernel TX timestamps (SO_TIMESTAMPING)
+    bool reactor        = false; // send ACKs and handle replies from one thread (per worker)
+    bool lock_memory    = false; // mlockall and pre-fault memory
+    bool min_timer_slack = false; // PR_SET_TIMERSLACK of 1 ns for the sender and receiver threads
     std::string statsfile;
+    std::string trace_format = "csv"; // format of the trace files: csv, binary or archive
+    std::vector<std::string> trace_sinks; // more outputs of the trace rows: ndjson, unix:PATH, csv:FILE, binary:FILE, archive:FILE
+    std::string tick_trace; // file to write the wakeup lateness of every ACK tick to
+    uint64_t trace_rotate_size = 0;     // start a new trace file when the current one reaches this size, 0 - off
+    int trace_rotate_interval_s = 0;    // start a new trace file after this many seconds, 0 - off
+    uint64_t flight_recorder_size = 0; // keep the latest trace rows in a circular file of this size, 0 - off
 };
 
 
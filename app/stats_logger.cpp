@@ -0,0 +1,227 @@
+#include "stats_logger.hpp"
+#include "trace_sink.hpp"
+#include <algorithm>
+
+#define LOG_TRACE "[TRACE] "
+
+using namespace std;
+using namespace std::chrono;
+
+trace_row to_trace_row(const trace_record& rec)
+{
+    return { duration_cast<microseconds>(rec.timepoint.time_since_epoch()).count(),
+        rec.us_elapsed_std, rec.us_elapsed_sys, rec.us_elapsed_kernel_std,
+        rec.ackack_timestamp_std, rec.ackack_timestamp_sys,
+        rec.rtt_sys, rec.rtt_std, rec.rtt_std_rma, rec.rtt_std_var,
+        rec.drift_sample_std, rec.drift, rec.overdrift,
+        duration_cast<nanoseconds>(rec.tsbpd_base.time_since_epoch()).count(),
+        static_cast<int32_t>(rec.drift_est), static_cast<int32_t>(rec.skew_ppb) };
+}
+
+trace_record to_trace_record(const trace_row& row)
+{
+    return { system_clock::time_point(duration_cast<system_clock::duration>(microseconds(row.us_timepoint_sys))),
+        row.us_elapsed_std, row.us_elapsed_sys, row.us_elapsed_kernel_std,
+        row.us_ackack_timestamp_std, row.us_ackack_timestamp_sys,
+        row.us_rtt_sys, row.us_rtt_std, row.us_smoothed_rtt_std, row.rtt_var_std,
+        row.us_drift_sample_std, row.us_drift_std, row.us_overdrift_std,
+        steady_clock::time_point(duration_cast<steady_clock::duration>(nanoseconds(row.ns_tsbpd_time_base_std))),
+        row.us_drift_est_std, row.ppb_skew_est };
+}
+
+void write_csv_header(std::ostream& out, bool compact_mode)
+{
+    out << "TimepointSys,usElapsedStd,usElapsedSys,usElapsedKernelStd,usAckAckTimestampStd,usAckAckTimestampSys,";
+    out << "usRTTSys,usRTTStd,usSmoothedRTTStd,RTTVarStd";
+    if (!compact_mode)
+        out << ",usDriftSampleStd,usDriftStd,usOverdriftStd,TsbpdTimeBaseStd,usDriftEstStd,ppmSkewEst";
+    out << "\n";
+}
+
+std::string_view csv_formatter::format(const trace_record& rec)
+{
+    char* p = format_timepoint(row_, rec.timepoint);
+    *p++ = ',';
+    p = format_int(p, rec.us_elapsed_std);
+    *p++ = ',';
+    p = format_int(p, rec.us_elapsed_sys);
+    *p++ = ',';
+    p = format_int(p, rec.us_elapsed_kernel_std);
+    *p++ = ',';
+    p = format_uint(p, rec.ackack_timestamp_std);
+    *p++ = ',';
+    p = format_uint(p, rec.ackack_timestamp_sys);
+    *p++ = ',';
+    p = format_int(p, rec.rtt_sys);
+    *p++ = ',';
+    p = format_int(p, rec.rtt_std);
+    *p++ = ',';
+    p = format_int(p, rec.rtt_std_rma);
+    *p++ = ',';
+    p = format_int(p, rec.rtt_std_var);
+    if (!compact_mode_)
+    {
+        *p++ = ',';
+        p = format_int(p, rec.drift_sample_std);
+        *p++ = ',';
+        p = format_int(p, rec.drift);
+        *p++ = ',';
+        p = format_int(p, rec.overdrift);
+        *p++ = ',';
+
+        if (tsbpd_base_len_ == 0 || rec.tsbpd_base != cached_tsbpd_base_)
+        {
+            cached_tsbpd_base_ = rec.tsbpd_base;
+            tsbpd_base_len_    = format_time_stdy(tsbpd_base_, rec.tsbpd_base) - tsbpd_base_;
+        }
+        memcpy(p, tsbpd_base_, tsbpd_base_len_);
+        p += tsbpd_base_len_;
+        *p++ = ',';
+        p = format_int(p, rec.drift_est);
+        *p++ = ',';
+
+        // ppm with three decimals
+        if (rec.skew_ppb < 0)
+            *p++ = '-';
+        const uint64_t ppb = rec.skew_ppb < 0 ? 0 - static_cast<uint64_t>(rec.skew_ppb) : rec.skew_ppb;
+        p = format_uint(p, ppb / 1000);
+        *p++ = '.';
+        p = format_uint_fixed(p, ppb % 1000, 3);
+    }
+    *p++ = '\n';
+    return std::string_view(row_, p - row_);
+}
+
+// Same as print_timestamp(): ISO 8601 with microseconds and the time zone offset.
+char* csv_formatter::format_timepoint(char* out, const system_clock::time_point& timepoint)
+{
+    const auto    since_epoch = timepoint.time_since_epoch();
+    const seconds s           = duration_cast<seconds>(since_epoch);
+    const time_t  sec         = static_cast<time_t>(s.count());
+    if (sec != cached_sec_)
+    {
+        // SysLocalTime returns zeroed tm on failure, which is ok for strftime.
+        const tm tm_now = sys_local_time(sec);
+        sec_prefix_len_ = strftime(sec_prefix_, sizeof sec_prefix_, "%FT%T.", &tm_now);
+        tz_suffix_len_  = strftime(tz_suffix_, sizeof tz_suffix_, "%z", &tm_now);
+        cached_sec_     = sec;
+    }
+
+    memcpy(out, sec_prefix_, sec_prefix_len_);
+    out = format_uint_fixed(out + sec_prefix_len_, duration_cast<microseconds>(since_epoch - s).count(), 6);
+    memcpy(out, tz_suffix_, tz_suffix_len_);
+    return out + tz_suffix_len_;
+}
+
+trace_channel::trace_channel(const std::string& name, std::vector<std::unique_ptr<trace_sink>> sinks)
+    : name_(name)
+    , sinks_(std::move(sinks))
+{
+}
+
+trace_channel::~trace_channel() = default;
+
+void trace_channel::drain()
+{
+    trace_record rec;
+    while (ring_.pop(rec))
+    {
+        for (auto& sink : sinks_)
+            sink->write(rec);
+    }
+
+    for (auto& sink : sinks_)
+        sink->flush();
+
+    const uint64_t dropped = this->dropped();
+    if (dropped != dropped_reported_)
+    {
+        spdlog::warn(LOG_TRACE "{}: {} rows dropped (the writer is behind), {} in total.", name_,
+            dropped - dropped_reported_, dropped);
+        dropped_reported_ = dropped;
+    }
+}
+
+stats_logger::stats_logger(const std::string& name, std::vector<std::unique_ptr<trace_sink>> sinks)
+    : channel_(make_shared<trace_channel>(name, std::move(sinks)))
+{
+    writer_ = trace_writer::acquire();
+    writer_->add(channel_);
+}
+
+stats_logger::~stats_logger()
+{
+    writer_->retire(std::move(channel_));
+}
+
+shared_ptr<trace_writer> trace_writer::acquire()
+{
+    static mutex                  s_mtx;
+    static weak_ptr<trace_writer> s_writer;
+
+    lock_guard<mutex> lck(s_mtx);
+    shared_ptr<trace_writer> writer = s_writer.lock();
+    if (!writer)
+    {
+        writer   = make_shared<trace_writer>();
+        s_writer = writer;
+    }
+    return writer;
+}
+
+trace_writer::trace_writer()
+    : thread_(&trace_writer::run, this)
+{
+}
+
+trace_writer::~trace_writer()
+{
+    {
+        lock_guard<mutex> lck(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void trace_writer::add(shared_ptr<trace_channel> channel)
+{
+    lock_guard<mutex> lck(mtx_);
+    added_.push_back(std::move(channel));
+}
+
+void trace_writer::retire(shared_ptr<trace_channel> channel)
+{
+    lock_guard<mutex> lck(mtx_);
+    retired_.push_back(std::move(channel));
+}
+
+void trace_writer::run()
+{
+    // Swapped with the queues, so their capacity is reused on both sides.
+    vector<shared_ptr<trace_channel>> added, retired;
+    for (bool stop = false; !stop;)
+    {
+        {
+            unique_lock<mutex> lck(mtx_);
+            // The producers never notify: waking up periodically keeps their side free of system calls.
+            cv_.wait_for(lck, drain_period, [this] { return stop_; });
+            stop = stop_;
+            added.swap(added_);
+            retired.swap(retired_);
+        }
+
+        channels_.insert(channels_.end(), added.begin(), added.end());
+        added.clear();
+        for (const auto& channel : retired)
+            channels_.erase(std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
+
+        for (const auto& channel : channels_)
+            channel->drain();
+
+        // The last rows of the retired channels, then their sinks are closed.
+        for (const auto& channel : retired)
+            channel->drain();
+        retired.clear();
+    }
+}
@@ -1,71 +1,194 @@
 #pragma once
 #include "stdafx.hpp"
+#include <condition_variable>
+#include <string_view>
+#include <thread>
+#include <vector>
 
+#include "spsc_ring.hpp"
+#include "trace_file.hpp"
 #include "utils.hpp"
 
-class stats_logger
+/// A row of the drift trace, as captured on the ACKACK reception.
+struct trace_record
+{
+    std::chrono::system_clock::time_point timepoint;
+    int64_t  us_elapsed_std;
+    int64_t  us_elapsed_sys;
+    int64_t  us_elapsed_kernel_std;
+    unsigned ackack_timestamp_std;
+    unsigned ackack_timestamp_sys;
+    int      rtt_sys;
+    int      rtt_std;
+    int      rtt_std_rma;
+    int      rtt_std_var;
+    int64_t  drift_sample_std;
+    int64_t  drift;
+    int64_t  overdrift;
+    std::chrono::steady_clock::time_point tsbpd_base;
+    int64_t  drift_est; // drift estimate of the skew estimator or the Kalman drift tracer (see tsbpd.hpp)
+    int64_t  skew_ppb;  // skew estimate, parts per billion
+};
+
+trace_row    to_trace_row(const trace_record& rec);
+trace_record to_trace_record(const trace_row& row);
+
+/// Write the header of the CSV trace.
+/// @param compact_mode skip the drift columns
+void write_csv_header(std::ostream& out, bool compact_mode);
+
+/// Formats rows of the CSV trace without memory allocations.
+/// The date and time up to the second of the timepoint column is rendered once per second,
+/// and the TSBPD time base only when it changes.
+class csv_formatter
 {
     using steady_clock = std::chrono::steady_clock;
     using system_clock = std::chrono::system_clock;
 public:
-    stats_logger(const std::string& filename, bool compact_mode)
+    /// @param compact_mode skip the drift columns
+    explicit csv_formatter(bool compact_mode)
         : compact_mode_(compact_mode)
     {
-        this->fout_.open(filename, std::ofstream::out);
-        if (!this->fout_)
-            throw std::runtime_error("Failed to open " + filename + "!!!");
-
-        print_header();
     }
 
-    ~stats_logger()
+    /// Format a row including the line break.
+    /// @returns The row, valid until the next call.
+    std::string_view format(const trace_record& rec);
+
+private:
+    char* format_timepoint(char* out, const system_clock::time_point& timepoint);
+
+private:
+    const bool compact_mode_;
+    char row_[512];
+
+    time_t cached_sec_ = -1;   // the second the prefix and the suffix are rendered for
+    char   sec_prefix_[32];    // "%FT%T."
+    size_t sec_prefix_len_ = 0;
+    char   tz_suffix_[16];     // "%z"
+    size_t tz_suffix_len_ = 0;
+
+    steady_clock::time_point cached_tsbpd_base_;
+    char   tsbpd_base_[40];
+    size_t tsbpd_base_len_ = 0;
+};
+
+class trace_writer;
+class trace_sink;
+
+/// The queued rows of a stats_logger and their sinks.
+/// Shared with the writer thread, which writes the last rows and closes the sinks after the logger is gone.
+class trace_channel
+{
+public:
+    trace_channel(const std::string& name, std::vector<std::unique_ptr<trace_sink>> sinks);
+    ~trace_channel();
+
+    /// Queue a row. Must be called from one thread only.
+    void push(const trace_record& rec)
     {
-        std::lock_guard<std::mutex> lck(this->mtx_);
-        this->fout_.close();
+        if (!ring_.push(rec))
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 
+    /// The number of rows dropped because the ring buffer was full.
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /// Write the queued rows to the sinks. Called by the writer thread only.
+    void drain();
+
+private:
+    // At the default ACK interval the writer needs to keep up with 100 rows per second.
+    static constexpr size_t ring_size = 1024;
+
+    const std::string name_;
+    std::vector<std::unique_ptr<trace_sink>> sinks_;
+
+    spsc_ring<trace_record, ring_size> ring_;
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t dropped_reported_ = 0; // accessed by the writer thread only
+};
+
+/// Drift trace of a peer.
+///
+/// trace() only copies the row into a lock-free ring buffer. A background thread (shared by all loggers)
+/// passes the rows to the sinks (files, standard output, sockets) in batches. If the writer falls behind
+/// and the ring is full, the row is dropped and counted. Neither the constructor nor the destructor
+/// wait for the writer: the rows left at destruction are written and the sinks closed by the writer thread.
+class stats_logger
+{
+    using steady_clock = std::chrono::steady_clock;
+    using system_clock = std::chrono::system_clock;
+public:
+    /// @param name used in the log, e.g. the peer address
+    /// @param sinks outputs of the rows, each batching them on its own
+    stats_logger(const std::string& name, std::vector<std::unique_ptr<trace_sink>> sinks);
+
+    /// Hands the pending rows and the sinks over to the writer thread.
+    ~stats_logger();
+
+    stats_logger(const stats_logger&) = delete;
+    stats_logger& operator=(const stats_logger&) = delete;
+
+    /// Queue a trace row. Must be called from one thread only (the reply loop of the peer).
+    /// @param elapsed_std time the ACKACK was read by the application (steady clock)
+    /// @param elapsed_sys time the ACKACK was received (system clock, kernel timestamp if available)
+    /// @param elapsed_kernel_std time the ACKACK was received by the kernel (steady clock),
+    ///        equal to @a elapsed_std if the kernel timestamp is not available
     void trace(const steady_clock::duration& elapsed_std, const system_clock::duration& elapsed_sys,
-        unsigned ackack_timestamp_std, unsigned ackack_timestamp_sys, int rtt_sys, int rtt_std, int rtt_std_rma, int rtt_std_var,
+        const steady_clock::duration& elapsed_kernel_std, unsigned ackack_timestamp_std, unsigned ackack_timestamp_sys, int rtt_sys, int rtt_std, int rtt_std_rma, int rtt_std_var,
         int64_t drift_sample_std, int64_t drift, int64_t overdrift,
-        const steady_clock::time_point& tsbpd_base)
+        const steady_clock::time_point& tsbpd_base, int64_t drift_est, double skew_ppm)
     {
         using namespace std::chrono;
-        std::lock_guard<std::mutex> lck(this->mtx_);
-
-        this->fout_ << print_timestamp() << ",";
-        this->fout_ << duration_cast<microseconds>(elapsed_std).count() << ",";
-        this->fout_ << duration_cast<microseconds>(elapsed_sys).count() << ",";
-        this->fout_ << ackack_timestamp_std << ",";
-        this->fout_ << ackack_timestamp_sys << ",";
-        this->fout_ << rtt_sys << ",";
-        this->fout_ << rtt_std << ",";
-        this->fout_ << rtt_std_rma << ",";
-        this->fout_ << rtt_std_var;
-        if (!compact_mode_)
-        {
-            this->fout_ << "," << drift_sample_std << ",";
-            this->fout_ << drift << ",";
-            this->fout_ << overdrift << ",";
-            this->fout_ << format_time_stdy(tsbpd_base);
-        }
-        this->fout_ << "\n";
-        this->fout_.flush();
+        const trace_record rec = { system_clock::now(),
+            duration_cast<microseconds>(elapsed_std).count(),
+            duration_cast<microseconds>(elapsed_sys).count(),
+            duration_cast<microseconds>(elapsed_kernel_std).count(),
+            ackack_timestamp_std, ackack_timestamp_sys, rtt_sys, rtt_std, rtt_std_rma, rtt_std_var,
+            drift_sample_std, drift, overdrift, tsbpd_base, drift_est, std::llround(skew_ppm * 1000) };
+
+        channel_->push(rec);
     }
 
+    /// The number of rows dropped because the ring buffer was full.
+    uint64_t dropped() const { return channel_->dropped(); }
+
 private:
-    void print_header()
-    {
-        //std::lock_guard<std::mutex> lck(this->mtx_);
-        this->fout_ << "TimepointSys,usElapsedStd,usElapsedSys,usAckAckTimestampStd,usAckAckTimestampSys,";
-        this->fout_ << "usRTTSys,usRTTStd,usSmoothedRTTStd,RTTVarStd";
-        if (!compact_mode_)
-            this->fout_ << ",usDriftSampleStd,usDriftStd,usOverdriftStd,TsbpdTimeBaseStd";
-        this->fout_ << "\n";
-    }
+    std::shared_ptr<trace_channel> channel_;
+    std::shared_ptr<trace_writer>  writer_;
+};
+
+/// Background thread that writes the queued rows of all registered stats loggers.
+/// The list of the channels is accessed by the writer thread only. Registering and retiring a channel
+/// is queued, so the threads of the loggers never wait for the disk.
+class trace_writer
+{
+public:
+    /// @returns The running writer, starting it if there is none.
+    /// The writer stops when the last reference is released, after writing the rows of the retired channels.
+    static std::shared_ptr<trace_writer> acquire();
+
+    trace_writer();
+    ~trace_writer();
+
+    void add(std::shared_ptr<trace_channel> channel);
+
+    /// The logger of the channel is gone: the writer thread writes the remaining rows and closes the sinks.
+    void retire(std::shared_ptr<trace_channel> channel);
 
 private:
-    const bool compact_mode_;
-    std::mutex mtx_;
-    std::ofstream fout_;
+    void run();
+
+private:
+    static constexpr std::chrono::milliseconds drain_period{20};
+
+    std::mutex                                  mtx_; // protects added_, retired_ and stop_, never held while writing
+    std::condition_variable                     cv_;
+    std::vector<std::shared_ptr<trace_channel>> added_;
+    std::vector<std::shared_ptr<trace_channel>> retired_;
+    bool                                        stop_ = false;
 
+    std::vector<std::shared_ptr<trace_channel>> channels_; // accessed by the writer thread only
+    std::thread                                 thread_;
 };
@@ -0,0 +1,161 @@
+#include "thread_sched.hpp"
+
+#if defined(__linux__)
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#define LOG_SCHED "[SCHED] "
+
+bool pin_this_thread(int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        spdlog::warn(LOG_SCHED "Invalid CPU {}.", cpu);
+        return false;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    const int res = pthread_setaffinity_np(pthread_self(), sizeof cpuset, &cpuset);
+    if (res != 0)
+    {
+        spdlog::warn(LOG_SCHED "Failed to pin a thread to CPU {}, error {}.", cpu, res);
+        return false;
+    }
+
+    return true;
+#else
+    spdlog::warn(LOG_SCHED "Pinning threads to CPU {} is not supported on this platform.", cpu);
+    return false;
+#endif
+}
+
+bool tune_this_thread(const thread_tuning& tuning, const char* name)
+{
+    bool ok = true;
+    std::string applied;
+
+    if (tuning.cpu >= 0)
+    {
+        if (pin_this_thread(tuning.cpu))
+            applied += fmt::format(" CPU {}", tuning.cpu);
+        else
+            ok = false;
+    }
+
+    if (tuning.fifo_priority > 0)
+    {
+#if defined(__linux__)
+        sched_param param = {};
+        param.sched_priority = tuning.fifo_priority;
+        const int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (res == 0)
+        {
+            applied += fmt::format(" SCHED_FIFO {}", tuning.fifo_priority);
+        }
+        else
+        {
+            // EPERM: needs CAP_SYS_NICE or an RLIMIT_RTPRIO limit.
+            spdlog::warn(LOG_SCHED "{}: failed to set SCHED_FIFO priority {}, error {}.", name, tuning.fifo_priority, res);
+            ok = false;
+        }
+#else
+        spdlog::warn(LOG_SCHED "{}: SCHED_FIFO is not supported on this platform.", name);
+        ok = false;
+#endif
+    }
+
+    if (tuning.min_timer_slack)
+    {
+#if defined(__linux__)
+        if (::prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0)
+        {
+            applied += " timer slack 1 ns";
+        }
+        else
+        {
+            spdlog::warn(LOG_SCHED "{}: failed to set the timer slack, error {}.", name, errno);
+            ok = false;
+        }
+#else
+        spdlog::warn(LOG_SCHED "{}: setting the timer slack is not supported on this platform.", name);
+        ok = false;
+#endif
+    }
+
+    if (!applied.empty())
+        spdlog::info(LOG_SCHED "{} thread:{}.", name, applied);
+
+    return ok;
+}
+
+bool lower_this_thread_priority(const char* name)
+{
+#if defined(__linux__)
+    sched_param param = {};
+    const int res = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if (res != 0)
+    {
+        spdlog::warn(LOG_SCHED "{}: failed to set SCHED_IDLE, error {}.", name, res);
+        return false;
+    }
+
+    // ioprio_set has no glibc wrapper. IOPRIO_WHO_PROCESS with 0 applies to the calling thread.
+    constexpr int ioprio_who_process = 1;
+    constexpr int ioprio_class_idle  = 3;
+    constexpr int ioprio_class_shift = 13;
+    if (::syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) != 0)
+        spdlog::warn(LOG_SCHED "{}: failed to set the idle I/O priority, error {}.", name, errno);
+
+    return true;
+#else
+    spdlog::warn(LOG_SCHED "{}: lowering the thread priority is not supported on this platform.", name);
+    return false;
+#endif
+}
+
+bool lock_memory(size_t prefault_stack)
+{
+#if defined(__linux__)
+    bool ok = true;
+    if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        // EPERM/ENOMEM: needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+        spdlog::warn(LOG_SCHED "Failed to lock memory (mlockall), error {}.", errno);
+        ok = false;
+    }
+
+#if defined(__GLIBC__)
+    // Freed memory stays in the process, so it does not have to be faulted in again.
+    if (mallopt(M_TRIM_THRESHOLD, -1) == 0 || mallopt(M_MMAP_MAX, 0) == 0)
+        spdlog::warn(LOG_SCHED "Failed to disable returning heap memory to the system.");
+#endif
+
+    // Touch the stack now rather than on the first deep call.
+    if (prefault_stack > 0)
+    {
+        volatile char* stack = static_cast<volatile char*>(alloca(prefault_stack));
+        for (size_t i = 0; i < prefault_stack; i += 4096)
+            stack[i] = 0;
+    }
+
+    if (ok)
+        spdlog::info(LOG_SCHED "Memory is locked.");
+    return ok;
+#else
+    spdlog::warn(LOG_SCHED "Locking memory is not supported on this platform.");
+    return false;
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "stdafx.hpp"
+
+/// Pin the calling thread to the CPU core @a cpu.
+/// @returns false if pinning failed or is not supported on the platform.
+bool pin_this_thread(int cpu);
+
+/// Scheduling settings of a latency-sensitive thread.
+struct thread_tuning
+{
+    int  cpu             = -1;    // CPU core to pin the thread to, -1 - no pinning
+    int  fifo_priority   = 0;     // SCHED_FIFO priority (1..99), 0 - keep the default policy
+    bool min_timer_slack = false; // set the timer slack to 1 ns (PR_SET_TIMERSLACK)
+};
+
+/// Apply @a tuning to the calling thread.
+/// Each setting that could not be applied is reported as a warning.
+/// @param name thread name used in the log, e.g. "SND"
+/// @returns false if any setting failed.
+bool tune_this_thread(const thread_tuning& tuning, const char* name);
+
+/// Run the calling thread only when the CPU and the disk are otherwise idle
+/// (SCHED_IDLE and the idle I/O priority class).
+/// Failures are reported as warnings.
+/// @param name thread name used in the log, e.g. "ZIP"
+/// @returns false if the CPU priority could not be lowered.
+bool lower_this_thread_priority(const char* name);
+
+/// Lock all current and future pages of the process in memory (mlockall),
+/// keep freed heap memory in the process and pre-fault @a prefault_stack bytes of the stack.
+/// Failures are reported as warnings.
+/// @returns false if memory could not be locked.
+bool lock_memory(size_t prefault_stack);
@@ -0,0 +1,112 @@
+#include "trace_compressor.hpp"
+#include "thread_sched.hpp"
+#include <filesystem>
+#include <zlib.h>
+
+#define LOG_TRACE "[TRACE] "
+
+using namespace std;
+
+shared_ptr<trace_compressor> trace_compressor::acquire()
+{
+    static mutex                      s_mtx;
+    static weak_ptr<trace_compressor> s_compressor;
+
+    lock_guard<mutex> lck(s_mtx);
+    shared_ptr<trace_compressor> compressor = s_compressor.lock();
+    if (!compressor)
+    {
+        compressor   = make_shared<trace_compressor>();
+        s_compressor = compressor;
+    }
+    return compressor;
+}
+
+trace_compressor::trace_compressor()
+    : thread_(&trace_compressor::run, this)
+{
+}
+
+trace_compressor::~trace_compressor()
+{
+    {
+        lock_guard<mutex> lck(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+
+    for (const string& filename : queue_)
+        spdlog::info(LOG_TRACE "{} is left uncompressed.", filename);
+}
+
+void trace_compressor::compress(const string& filename)
+{
+    {
+        lock_guard<mutex> lck(mtx_);
+        queue_.push_back(filename);
+    }
+    cv_.notify_one();
+}
+
+void trace_compressor::run()
+{
+    lower_this_thread_priority("ZIP");
+
+    unique_lock<mutex> lck(mtx_);
+    while (true)
+    {
+        cv_.wait(lck, [this] { return stop_ || !queue_.empty(); });
+        if (stop_)
+            return;
+
+        const string filename = queue_.front();
+        queue_.pop_front();
+        lck.unlock();
+        compress_file(filename);
+        lck.lock();
+    }
+}
+
+bool trace_compressor::compress_file(const string& filename)
+{
+    const string gz_filename = filename + ".gz";
+    ifstream     in(filename, ios::binary);
+    gzFile       out = gzopen(gz_filename.c_str(), "wb6");
+    if (!in || !out)
+    {
+        if (out)
+            gzclose(out);
+        spdlog::error(LOG_TRACE "Failed to compress {}: can't open the files.", filename);
+        return false;
+    }
+
+    vector<char> buf(256 * 1024);
+    bool         ok = true;
+    while (ok && !stop_)
+    {
+        in.read(buf.data(), buf.size());
+        const streamsize len = in.gcount();
+        if (len == 0)
+            break;
+        ok = gzwrite(out, buf.data(), static_cast<unsigned>(len)) == len;
+    }
+    ok = gzclose(out) == Z_OK && ok && !in.bad();
+
+    error_code ec;
+    if (!ok || stop_)
+    {
+        filesystem::remove(gz_filename, ec);
+        if (!ok)
+            spdlog::error(LOG_TRACE "Failed to compress {}.", filename);
+        else
+            spdlog::info(LOG_TRACE "{} is left uncompressed.", filename);
+        return false;
+    }
+
+    const auto size    = filesystem::file_size(filename, ec);
+    const auto gz_size = filesystem::file_size(gz_filename, ec);
+    filesystem::remove(filename, ec);
+    spdlog::info(LOG_TRACE "Compressed {} ({} -> {} bytes).", gz_filename, size, gz_size);
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "stdafx.hpp"
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+/// Background thread that gzips closed trace segments (see stats_logger rotation).
+///
+/// The thread runs with the lowest CPU and I/O priority. A compressed segment "trace-x.csv"
+/// is replaced by "trace-x.csv.gz". If the compressor is stopped, the segment being compressed
+/// and the queued ones are left as they are.
+class trace_compressor
+{
+public:
+    /// @returns The running compressor, starting it if there is none.
+    /// The compressor stops when the last reference is released.
+    static std::shared_ptr<trace_compressor> acquire();
+
+    trace_compressor();
+    ~trace_compressor();
+
+    /// Queue a closed file for compression. Never blocks on the compression itself.
+    void compress(const std::string& filename);
+
+private:
+    void run();
+
+    /// @returns false if compression failed or was interrupted (the source file is kept).
+    bool compress_file(const std::string& filename);
+
+private:
+    std::mutex              mtx_; // protects queue_ and stop_
+    std::condition_variable cv_;
+    std::deque<std::string> queue_;
+    std::atomic_bool        stop_{false};
+    std::thread             thread_;
+};
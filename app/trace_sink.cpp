@@ -0,0 +1,423 @@
+#include "trace_sink.hpp"
+#include "flight_recorder.hpp"
+#include "trace_compressor.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define LOG_TRACE "[TRACE] "
+
+using namespace std;
+using namespace std::chrono;
+
+trace_file_sink::trace_file_sink(const string& filename, const trace_options& options, bool append)
+    : filename_(filename)
+    , options_(options)
+    , csv_(options.compact_mode)
+{
+    open(append);
+
+    // The flight recorder file has a fixed size.
+    if (!recorder_ && (options_.rotate_size || options_.rotate_interval.count()))
+        compressor_ = trace_compressor::acquire();
+}
+
+trace_file_sink::~trace_file_sink()
+{
+    close();
+}
+
+void trace_file_sink::write(const trace_record& rec)
+{
+    if (recorder_)
+        recorder_->write(rec);
+    else if (fout_bin_)
+        fout_bin_->write(to_trace_row(rec));
+    else if (fout_arch_)
+        fout_arch_->write(to_trace_row(rec));
+    else
+    {
+        const string_view row = csv_.format(rec);
+        fout_.write(row.data(), row.size());
+    }
+    written_ = true;
+}
+
+void trace_file_sink::flush()
+{
+    if (!written_)
+        return;
+    written_ = false;
+
+    // The archive is written in whole blocks, flushing it would write short ones.
+    if (recorder_)
+        recorder_->sync();
+    else if (fout_bin_)
+        fout_bin_->flush();
+    else if (!fout_arch_)
+        fout_.flush();
+
+    if (rotation_due())
+        rotate();
+}
+
+void trace_file_sink::open(bool append)
+{
+    segment_start_ = system_clock::now();
+    if (options_.flight_recorder_size)
+    {
+        recorder_ = make_unique<flight_recorder>(filename_, options_.flight_recorder_size, options_.config, append);
+    }
+    else if (options_.format == trace_format::binary)
+    {
+        fout_bin_ = make_unique<trace_file_writer>(filename_, options_.config, append);
+    }
+    else if (options_.format == trace_format::archive)
+    {
+        fout_arch_ = make_unique<trace_archive_writer>(filename_, options_.config, append);
+    }
+    else
+    {
+        fout_.open(filename_, append ? ofstream::app : ofstream::out);
+        if (!fout_)
+            throw runtime_error("Failed to open " + filename_ + "!!!");
+
+        if (!append || fout_.tellp() == 0)
+            write_csv_header(fout_, options_.compact_mode);
+        fout_.flush();
+    }
+}
+
+void trace_file_sink::close()
+{
+    recorder_.reset();
+    if (fout_bin_)
+        fout_bin_->close();
+    else if (fout_arch_)
+        fout_arch_->close();
+    else
+        fout_.close();
+    fout_bin_.reset();
+    fout_arch_.reset();
+}
+
+bool trace_file_sink::rotation_due() const
+{
+    if (!compressor_)
+        return false;
+
+    if (options_.rotate_interval.count() && system_clock::now() - segment_start_ >= options_.rotate_interval)
+        return true;
+
+    // The archive is written in whole blocks, so its size lags behind by up to a block.
+    error_code ec;
+    return options_.rotate_size && filesystem::file_size(filename_, ec) >= options_.rotate_size && !ec;
+}
+
+void trace_file_sink::rotate()
+{
+    // trace.csv -> trace-20240131-235959.csv
+    const size_t dot  = filename_.find_last_of('.');
+    const size_t sep  = filename_.find_last_of("/\\");
+    const bool   ext  = dot != string::npos && (sep == string::npos || dot > sep);
+    const string stem = ext ? filename_.substr(0, dot) : filename_;
+    const string suffix = ext ? filename_.substr(dot) : string();
+
+    const tm tm_start = sys_local_time(system_clock::to_time_t(segment_start_));
+    char     start[32];
+    strftime(start, sizeof start, "%Y%m%d-%H%M%S", &tm_start);
+    string segment_name = stem + "-" + start + suffix;
+    for (int i = 1; filesystem::exists(segment_name) || filesystem::exists(segment_name + ".gz"); ++i)
+        segment_name = stem + "-" + start + "-" + to_string(i) + suffix;
+
+    close();
+    error_code ec;
+    filesystem::rename(filename_, segment_name, ec);
+    if (ec)
+        spdlog::error(LOG_TRACE "Failed to rename {} to {}: {}.", filename_, segment_name, ec.message());
+
+    // If renaming failed, continue the same file.
+    try
+    {
+        open(static_cast<bool>(ec));
+    }
+    catch (const runtime_error& e)
+    {
+        spdlog::error(LOG_TRACE "{}", e.what());
+    }
+
+    if (ec)
+        return;
+
+    spdlog::info(LOG_TRACE "{}: closed segment {}.", filename_, segment_name);
+    // The archive is compressed already.
+    if (options_.format != trace_format::archive)
+        compressor_->compress(segment_name);
+}
+
+ndjson_formatter::ndjson_formatter(const string& peer)
+{
+    // Peer addresses have no characters to escape.
+    const string prefix = "{\"peer\":\"" + peer.substr(0, 128) + "\"";
+    memcpy(row_, prefix.data(), prefix.size());
+    prefix_len_ = prefix.size();
+}
+
+string_view ndjson_formatter::format(const trace_record& rec)
+{
+    const trace_row row = to_trace_row(rec);
+    char*           p   = row_ + prefix_len_;
+    const auto field = [&p](const char* key, size_t key_len, int64_t value) {
+        memcpy(p, key, key_len);
+        p = format_int(p + key_len, value);
+    };
+#define NDJSON_FIELD(name, value) field(",\"" name "\":", sizeof(",\"" name "\":") - 1, value)
+    NDJSON_FIELD("usTimepointSys", row.us_timepoint_sys);
+    NDJSON_FIELD("usElapsedStd", row.us_elapsed_std);
+    NDJSON_FIELD("usElapsedSys", row.us_elapsed_sys);
+    NDJSON_FIELD("usElapsedKernelStd", row.us_elapsed_kernel_std);
+    NDJSON_FIELD("usAckAckTimestampStd", row.us_ackack_timestamp_std);
+    NDJSON_FIELD("usAckAckTimestampSys", row.us_ackack_timestamp_sys);
+    NDJSON_FIELD("usRTTSys", row.us_rtt_sys);
+    NDJSON_FIELD("usRTTStd", row.us_rtt_std);
+    NDJSON_FIELD("usSmoothedRTTStd", row.us_smoothed_rtt_std);
+    NDJSON_FIELD("RTTVarStd", row.rtt_var_std);
+    NDJSON_FIELD("usDriftSampleStd", row.us_drift_sample_std);
+    NDJSON_FIELD("usDriftStd", row.us_drift_std);
+    NDJSON_FIELD("usOverdriftStd", row.us_overdrift_std);
+    NDJSON_FIELD("nsTsbpdTimeBaseStd", row.ns_tsbpd_time_base_std);
+    NDJSON_FIELD("usDriftEstStd", row.us_drift_est_std);
+    NDJSON_FIELD("ppbSkewEst", row.ppb_skew_est);
+#undef NDJSON_FIELD
+    *p++ = '}';
+    *p++ = '\n';
+    return string_view(row_, p - row_);
+}
+
+namespace
+{
+
+/// The standard output of the ndjson sinks. While the reader of a pipe or a socket is behind, the rows are
+/// dropped instead of blocking the trace writer (as in unix_socket_sink). A row is never written in part:
+/// the rest of a row cut by a short write goes out before any other row.
+/// Used by the trace writer thread only, so the rows of the peers never interleave.
+class stdout_writer
+{
+public:
+    stdout_writer()
+    {
+#ifndef _WIN32
+        // O_NONBLOCK is a flag of the open file, which the standard error or the shell may share.
+        // A pipe is reopened to get a file of its own. Files and terminals are written as usual.
+        struct stat st = {};
+        if (::fstat(STDOUT_FILENO, &st) != 0)
+            return;
+        if (S_ISFIFO(st.st_mode))
+            fd_ = ::open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd_ == -1 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+        {
+            fd_          = STDOUT_FILENO;
+            saved_flags_ = ::fcntl(fd_, F_GETFL);
+            if (saved_flags_ == -1 || ::fcntl(fd_, F_SETFL, saved_flags_ | O_NONBLOCK) == -1)
+                fd_ = -1;
+        }
+#endif
+    }
+
+    ~stdout_writer()
+    {
+#ifndef _WIN32
+        if (fd_ == STDOUT_FILENO)
+            ::fcntl(fd_, F_SETFL, saved_flags_);
+        else if (fd_ != -1)
+            ::close(fd_);
+#endif
+    }
+
+    stdout_writer(const stdout_writer&) = delete;
+    stdout_writer& operator=(const stdout_writer&) = delete;
+
+    /// Write whole rows, or drop them if the reader is behind.
+    void write(string_view rows)
+    {
+        if (!pending_.empty())
+        {
+            pending_.erase(0, write_some(pending_));
+            if (!pending_.empty())
+                return drop(rows);
+        }
+
+        const size_t written = write_some(rows);
+        if (written == rows.size())
+        {
+            if (!writing_)
+                spdlog::info(LOG_TRACE "stdout: the reader is back, {} rows were dropped.", dropped_);
+            writing_ = true;
+            dropped_ = 0;
+            return;
+        }
+
+        // Finish the row written in part later, drop the following ones.
+        const size_t row_end = written == 0 ? 0 : rows.find('\n', written - 1) + 1;
+        pending_.assign(rows.substr(written, row_end - written));
+        drop(rows.substr(row_end));
+    }
+
+private:
+    /// @returns The number of bytes written before the output would block.
+    size_t write_some(string_view data)
+    {
+#ifndef _WIN32
+        if (fd_ != -1)
+        {
+            size_t written = 0;
+            while (written < data.size())
+            {
+                const ssize_t res = ::write(fd_, data.data() + written, data.size() - written);
+                if (res > 0)
+                    written += res;
+                else if (res == -1 && errno != EINTR)
+                    break;
+            }
+            return written;
+        }
+#endif
+        const size_t written = fwrite(data.data(), 1, data.size(), stdout);
+        fflush(stdout);
+        return written;
+    }
+
+    void drop(string_view rows)
+    {
+        if (rows.empty())
+            return;
+        if (writing_)
+            spdlog::warn(LOG_TRACE "stdout: the reader is behind. Dropping rows until it reads them.");
+        writing_ = false;
+        dropped_ += count(rows.begin(), rows.end(), '\n');
+    }
+
+private:
+    int      fd_          = -1; // -1 - blocking stdio
+    int      saved_flags_ = 0;  // of STDOUT_FILENO, restored on exit
+    string   pending_;          // the rest of a row written in part
+    uint64_t dropped_ = 0;      // rows dropped since the reader is behind
+    bool     writing_ = true;
+};
+
+stdout_writer& shared_stdout()
+{
+    static stdout_writer s_stdout;
+    return s_stdout;
+}
+
+} // namespace
+
+ndjson_sink::ndjson_sink(const string& peer)
+    : json_(peer)
+{
+}
+
+void ndjson_sink::write(const trace_record& rec)
+{
+    batch_.append(json_.format(rec));
+}
+
+void ndjson_sink::flush()
+{
+    if (batch_.empty())
+        return;
+
+    shared_stdout().write(batch_);
+    batch_.clear();
+}
+
+#ifndef _WIN32
+
+unix_socket_sink::unix_socket_sink(const string& path, const string& peer)
+    : path_(path)
+    , json_(peer)
+{
+    if (path.size() >= sizeof(sockaddr_un::sun_path))
+        throw runtime_error("The Unix socket path is too long: " + path);
+
+    sock_ = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock_ == -1)
+        throw runtime_error("Failed to create a Unix socket, error " + to_string(errno));
+    datagram_.reserve(max_datagram_size);
+}
+
+unix_socket_sink::~unix_socket_sink()
+{
+    ::close(sock_);
+}
+
+void unix_socket_sink::send_datagram()
+{
+    if (datagram_.empty())
+        return;
+
+    const size_t rows = count(datagram_.begin(), datagram_.end(), '\n');
+    sockaddr_un  addr = {};
+    addr.sun_family   = AF_UNIX;
+    memcpy(addr.sun_path, path_.data(), path_.size());
+
+    const ssize_t res = ::sendto(sock_, datagram_.data(), datagram_.size(), MSG_DONTWAIT,
+        reinterpret_cast<const sockaddr*>(&addr), sizeof addr);
+    datagram_.clear();
+
+    if (res != -1)
+    {
+        if (!receiving_)
+            spdlog::info(LOG_TRACE "{}: the receiver is back, {} rows were dropped.", path_, dropped_);
+        receiving_ = true;
+        dropped_   = 0;
+        return;
+    }
+
+    // ENOENT, ECONNREFUSED: nobody is bound to the path; EAGAIN, ENOBUFS: the receiver is behind.
+    if (receiving_)
+        spdlog::warn(LOG_TRACE "{}: failed to send, error {}. Dropping rows until the receiver reads them.", path_, errno);
+    receiving_ = false;
+    dropped_ += rows;
+}
+
+#else
+
+unix_socket_sink::unix_socket_sink(const string& path, const string& peer)
+    : path_(path)
+    , json_(peer)
+{
+    throw runtime_error("Unix socket trace sinks are not supported on this platform");
+}
+
+unix_socket_sink::~unix_socket_sink()
+{
+}
+
+void unix_socket_sink::send_datagram()
+{
+}
+
+#endif
+
+void unix_socket_sink::write(const trace_record& rec)
+{
+    const string_view row = json_.format(rec);
+    if (datagram_.size() + row.size() > max_datagram_size)
+        send_datagram();
+    datagram_.append(row);
+}
+
+void unix_socket_sink::flush()
+{
+    send_datagram();
+}
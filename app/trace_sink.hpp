@@ -0,0 +1,141 @@
+#pragma once
+#include "stdafx.hpp"
+#include <string_view>
+
+#include "stats_logger.hpp"
+#include "trace_archive.hpp"
+
+class trace_compressor;
+class flight_recorder;
+
+/// Output of the trace rows of a peer. Called by the trace writer thread only (see stats_logger).
+class trace_sink
+{
+public:
+    virtual ~trace_sink() = default;
+
+    /// Write a row. The sink may keep it until flush().
+    virtual void write(const trace_record& rec) = 0;
+
+    /// End of a batch of rows.
+    virtual void flush() = 0;
+};
+
+enum class trace_format
+{
+    csv,
+    binary,  // see trace_file.hpp
+    archive, // see trace_archive.hpp
+};
+
+struct trace_options
+{
+    trace_format format       = trace_format::csv;
+    bool         compact_mode = false; // skip the drift columns (CSV only)
+    std::string  config;               // description of the tracing configuration (stored in binary traces)
+    size_t       flight_recorder_size = 0; // keep the latest rows in a circular file of this size (overrides the format), 0 - off
+    uint64_t     rotate_size = 0;          // start a new file when the current one reaches this size, 0 - off
+    std::chrono::seconds rotate_interval{0}; // start a new file after this time, 0 - off
+};
+
+/// Trace file: CSV, binary trace, trace archive or flight recorder.
+///
+/// With rotation enabled, the file is renamed to "<name>-<start time>.<ext>" between rows
+/// and a new one is started (with the header). Closed CSV and binary segments are gzipped by trace_compressor.
+class trace_file_sink : public trace_sink
+{
+    using system_clock = std::chrono::system_clock;
+public:
+    /// @param append continue an existing trace file instead of overwriting it
+    /// @throws std::runtime_error if the file can't be opened.
+    trace_file_sink(const std::string& filename, const trace_options& options, bool append = false);
+    ~trace_file_sink() override;
+
+    void write(const trace_record& rec) override;
+    void flush() override;
+
+private:
+    void open(bool append);
+    void close();
+
+    /// @returns true if the current segment has reached the rotation size or interval.
+    bool rotation_due() const;
+
+    /// Close the current file, rename it and start a new one.
+    void rotate();
+
+private:
+    const std::string filename_;
+    const trace_options options_;
+    system_clock::time_point segment_start_;     // when the current file was opened
+    std::ofstream fout_;                           // CSV trace
+    csv_formatter csv_;
+    std::unique_ptr<trace_file_writer> fout_bin_;  // binary trace
+    std::unique_ptr<trace_archive_writer> fout_arch_; // compressed trace archive
+    std::unique_ptr<flight_recorder> recorder_;
+    std::shared_ptr<trace_compressor> compressor_; // only with rotation
+    bool written_ = false;                         // rows since the last flush
+};
+
+/// Formats rows as JSON objects (one line each) without memory allocations.
+/// The keys are the column names of the binary trace, e.g. {"peer":"10.0.0.1:4200","usTimepointSys":...}.
+class ndjson_formatter
+{
+public:
+    /// @param peer the value of the "peer" key
+    explicit ndjson_formatter(const std::string& peer);
+
+    /// Format a row including the line break.
+    /// @returns The row, valid until the next call.
+    std::string_view format(const trace_record& rec);
+
+private:
+    char   row_[768];
+    size_t prefix_len_ = 0; // {"peer":"...",
+};
+
+/// Newline-delimited JSON on the standard output. The rows of a batch are written at once.
+/// While the reader of a pipe or a socket is behind the rows are dropped, so a slow consumer
+/// never holds back the trace writer (and the file sinks of the other peers).
+class ndjson_sink : public trace_sink
+{
+public:
+    explicit ndjson_sink(const std::string& peer);
+
+    void write(const trace_record& rec) override;
+    void flush() override;
+
+private:
+    ndjson_formatter json_;
+    std::string      batch_;
+};
+
+/// Newline-delimited JSON sent to a Unix domain datagram socket.
+///
+/// The rows of a batch are packed into datagrams of up to max_datagram_size bytes, a row is never split.
+/// While there is no receiver or its socket buffer is full the rows are dropped, so a slow consumer
+/// never holds back the trace writer.
+class unix_socket_sink : public trace_sink
+{
+public:
+    /// @param path the socket of the receiver, it may be bound later
+    /// @throws std::runtime_error if the socket can't be created or is not supported on the platform.
+    unix_socket_sink(const std::string& path, const std::string& peer);
+    ~unix_socket_sink() override;
+
+    void write(const trace_record& rec) override;
+    void flush() override;
+
+private:
+    void send_datagram();
+
+private:
+    static constexpr size_t max_datagram_size = 2048; // the default limit on macOS
+
+    const std::string path_;
+    int               sock_ = -1;
+    ndjson_formatter  json_;
+    std::string       datagram_;
+    uint64_t          dropped_   = 0; // rows dropped since the receiver is lost
+    bool              receiving_ = true;
+};
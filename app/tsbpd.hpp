@@ -1,15 +1,72 @@
+#pragma once
 #include "stdafx.hpp"
 
+#include <type_traits>
+
 #include "utils.hpp"
+#include "drift_sample_filter.hpp"
 #include "drift_tracer.hpp"
+#include "skew_estimator.hpp"
+
+/// Max drift (usec) above which TsbPD Time Offset is adjusted (default)
+static const int TSBPD_DRIFT_MAX_VALUE = 5000;
+/// Number of samples (UMSG_ACKACK packets) to perform drift calculation and compensation (default)
+static const int TSBPD_DRIFT_MAX_SAMPLES = 1000;
 
-class tsbpd
+enum class drift_tracer_kind
+{
+    mean,   // DriftTracer
+    median, // MedianDriftTracer
+    kalman, // KalmanDriftTracer
+};
+
+struct tsbpd_options
+{
+    bool         compensate_rtt = false;             // compensate RTT variations in the drift samples
+    drift_filter filter         = drift_filter::off; // drift samples passed to the drift tracer
+    bool         log_events     = true;              // log the time base shifts and wrap periods
+    // The drift tracer, selected by make_tsbpd() (see tsbpd_dispatch.hpp).
+    drift_tracer_kind drift_tracer = drift_tracer_kind::mean;
+    unsigned          max_span     = TSBPD_DRIFT_MAX_SAMPLES; // not used by kalman
+    int               max_drift    = TSBPD_DRIFT_MAX_VALUE;
+};
+
+/// True for the drift tracers modelling the peer's clock (KalmanDriftTracer), which estimate the skew themselves.
+template <class T, class = void>
+struct models_clock : std::false_type
+{
+};
+
+template <class T>
+struct models_clock<T, std::void_t<decltype(std::declval<const T&>().skew_ppm())>> : std::true_type
+{
+};
+
+/// TSBPD time base of a peer, corrected for the clock drift as in SRT.
+/// @tparam DRIFT_TRACER the drift estimate that shifts the time base: DriftTracer<MAX_SPAN, MAX_DRIFT> (the mean
+///         of blocks of MAX_SPAN samples, as in SRT), MedianDriftTracer<MAX_SPAN, MAX_DRIFT> (sliding median)
+///         or KalmanDriftTracer<MAX_DRIFT> (clock model)
+/// @tparam SKEW_ESTIMATOR continuous estimator of the drift and the clock skew, reported along with the samples
+///         (see lsq_skew_estimator); it does not affect the time base. Not used if the drift tracer models the clock:
+///         the state of the drift tracer is reported instead.
+template <class DRIFT_TRACER, class SKEW_ESTIMATOR = lsq_skew_estimator<>>
+class basic_tsbpd
 {
     using steady_clock = std::chrono::steady_clock;
 public:
+    explicit basic_tsbpd(const tsbpd_options& options = tsbpd_options())
+        : m_filter(options.filter)
+        , m_compensate_rtt(options.compensate_rtt)
+        , m_log_events(options.log_events)
+    {
+    }
+
+    /// @param rtt the RTT sample of the ACKACK, the smoothed RTT and RTT variance before it
     /// @returns current drift sample
-    long long on_ackack(unsigned timestamp_us, int rtt_us, const steady_clock::time_point& recv_time_std)
+    long long on_ackack(unsigned timestamp_us, const rtt_sample& rtt, const steady_clock::time_point& recv_time_std)
     {
+        m_overdrift_us = 0;
+        const int rtt_us = m_compensate_rtt ? rtt.rtt_us : 0;
         if (m_tsTsbPdTimeBase == steady_clock::time_point())
         {
             m_tsTsbPdTimeBase = recv_time_std - microseconds_from(timestamp_us);
@@ -17,38 +74,131 @@ public:
             return 0;
         }
 
+        // Shift if wrapping period ends. Before taking the time base, otherwise the sample
+        // ending the wrap period would be measured against the base of the previous period.
+        updateTsbPdTimeBase(timestamp_us);
+
         const steady_clock::duration drift =
             recv_time_std - (get_pkt_time_base(timestamp_us) + microseconds_from(timestamp_us));
         const long long drift_us = count_microseconds(drift) - (rtt_us - m_first_rtt_us) / 2;
-        const bool updated = m_drift_tracer.update(drift_us);
+
+        // The estimator needs the drift against a fixed base, without the shifts below.
+        if constexpr (!models_clock<DRIFT_TRACER>::value)
+            m_skew_estimator.update(count_microseconds(recv_time_std), drift_us + m_shifts_us);
+
+        int64_t filtered_us = drift_us;
+        if (!m_filter.filter(filtered_us, rtt))
+            return drift_us;
+
+        bool updated;
+        if constexpr (std::is_invocable_v<decltype(&DRIFT_TRACER::update), DRIFT_TRACER&, int64_t, int64_t, int>)
+            updated = m_drift_tracer.update(filtered_us, count_microseconds(recv_time_std), rtt.rtt_var_us);
+        else
+            updated = m_drift_tracer.update(filtered_us);
         if (updated)
         {
             // tracer's overdrift will be reset to 0 with the next incoming sample.
-            steady_clock::duration overdrift = microseconds_from(m_drift_tracer.overdrift());
+            m_overdrift_us = m_drift_tracer.overdrift();
+            steady_clock::duration overdrift = microseconds_from(m_overdrift_us);
             m_tsTsbPdTimeBase += overdrift;
+            m_shifts_us += m_overdrift_us;
+            m_filter.on_shift(m_overdrift_us);
 
-            spdlog::info("TSBPD base time shift {} us, drift {}", count_microseconds(overdrift), m_drift_tracer.drift());
+            if (m_log_events && m_filter.mode() != drift_filter::off)
+                spdlog::info("TSBPD base time shift {} us, drift {}, {} of {} samples filtered out", count_microseconds(overdrift),
+                    m_drift_tracer.drift(), m_filter.rejected(), m_filter.rejected() + m_filter.forwarded());
+            else if (m_log_events)
+                spdlog::info("TSBPD base time shift {} us, drift {}", count_microseconds(overdrift), m_drift_tracer.drift());
         }
 
-        updateTsbPdTimeBase(timestamp_us); // Shift if wrapping period ends.
-
         return drift_us;
     }
 
-    void updateTsbPdTimeBase(uint32_t usPktTimestamp);
+    void updateTsbPdTimeBase(uint32_t usPktTimestamp)
+    {
+        if (m_bTsbPdWrapCheck)
+        {
+            // Wrap check period.
+            if ((usPktTimestamp >= TSBPD_WRAP_PERIOD) && (usPktTimestamp <= (TSBPD_WRAP_PERIOD * 2)))
+            {
+                /* Exiting wrap check period (if for packet delivery head) */
+                m_bTsbPdWrapCheck = false;
+                m_tsTsbPdTimeBase += microseconds_from(int64_t(MAX_TIMESTAMP) + 1);
+                if (m_log_events)
+                    spdlog::info("TSBPD wrap period ends with ts={}, drift: {}", usPktTimestamp, m_drift_tracer.drift());
+            }
+            return;
+        }
+
+        // Check if timestamp is in the last 30 seconds before reaching the MAX_TIMESTAMP.
+        if (usPktTimestamp > (MAX_TIMESTAMP - TSBPD_WRAP_PERIOD))
+        {
+            // Approching wrap around point, start wrap check period (if for packet delivery head)
+            m_bTsbPdWrapCheck = true;
+            if (m_log_events)
+                spdlog::info("TSBPD wrap period begins with ts={}, drift: {}", usPktTimestamp, m_drift_tracer.drift());
+        }
+    }
+
+    steady_clock::time_point get_pkt_time_base(uint32_t timestamp_us) const
+    {
+        const uint64_t carryover_us =
+            (m_bTsbPdWrapCheck && timestamp_us < TSBPD_WRAP_PERIOD) ? uint64_t(MAX_TIMESTAMP) + 1 : 0;
 
-    steady_clock::time_point get_pkt_time_base(uint32_t timestamp_us) const;
+        return (m_tsTsbPdTimeBase + microseconds_from(carryover_us));
+    }
 
+    const DRIFT_TRACER& drift_tracer() const { return m_drift_tracer; }
     int64_t drift() const { return m_drift_tracer.drift(); }
-    int64_t overdrift() const { return m_drift_tracer.overdrift(); }
+
+    /// The shift of the time base by the last sample.
+    int64_t overdrift() const { return m_overdrift_us; }
+
+    const drift_sample_filter& filter() const { return m_filter; }
+
+    /// The drift against the current time base, as estimated by the skew estimator or the drift tracer modelling the clock.
+    int64_t drift_estimate() const
+    {
+        if constexpr (models_clock<DRIFT_TRACER>::value)
+            return m_drift_tracer.drift();
+        else
+            return m_skew_estimator.offset_us() - m_shifts_us;
+    }
+
+    /// The skew of the peer's clock, ppm.
+    double skew_ppm() const
+    {
+        if constexpr (models_clock<DRIFT_TRACER>::value)
+            return m_drift_tracer.skew_ppm();
+        else
+            return m_skew_estimator.skew_ppm();
+    }
+
+    /// Standard deviations of the drift (us) and the skew (ppm) estimates, 0 if not known (the skew estimator).
+    double drift_estimate_stddev() const
+    {
+        if constexpr (models_clock<DRIFT_TRACER>::value)
+            return std::sqrt(m_drift_tracer.drift_variance());
+        else
+            return 0;
+    }
+
+    double skew_stddev_ppm() const
+    {
+        if constexpr (models_clock<DRIFT_TRACER>::value)
+            return std::sqrt(m_drift_tracer.skew_variance());
+        else
+            return 0;
+    }
+
     steady_clock::time_point get_time_base() const { return m_tsTsbPdTimeBase; }
 
 private:
-    /// Max drift (usec) above which TsbPD Time Offset is adjusted
-    static const int TSBPD_DRIFT_MAX_VALUE = 5000;
-    /// Number of samples (UMSG_ACKACK packets) to perform drift calculation and compensation
-    static const int TSBPD_DRIFT_MAX_SAMPLES = 1000;
-    DriftTracer<TSBPD_DRIFT_MAX_SAMPLES, TSBPD_DRIFT_MAX_VALUE> m_drift_tracer;
+    DRIFT_TRACER m_drift_tracer;
+    SKEW_ESTIMATOR m_skew_estimator;
+    drift_sample_filter m_filter;
+    int64_t m_shifts_us = 0; // the sum of the time base shifts by the drift tracer
+    int64_t m_overdrift_us = 0;
 
     steady_clock::time_point m_tsTsbPdTimeBase = {};   // localtime base for TsbPd mode
     // Note: m_tsTsbPdTimeBase cumulates values from:
@@ -66,5 +216,62 @@ private:
 
     bool m_bTsbPdWrapCheck = false;              // true: check packet time stamp wrap around
     int m_first_rtt_us = 0;
+    const bool m_compensate_rtt;
+    const bool m_log_events;
     static const uint32_t TSBPD_WRAP_PERIOD = (30*1000000);    //30 seconds (in usec)
+    static const uint32_t MAX_TIMESTAMP = 0xFFFFFFFF; //Full 32 bit (01h11m35s)
+};
+
+using tsbpd = basic_tsbpd<DriftTracer<TSBPD_DRIFT_MAX_SAMPLES, TSBPD_DRIFT_MAX_VALUE>>;
+
+/// TSBPD state with the drift tracer selected at run time (see make_tsbpd()).
+/// Only the calls per ACKACK are virtual, the drift tracer inside is a compile-time specialization
+/// with constant divisors and limits.
+class any_tsbpd
+{
+protected:
+    using steady_clock = std::chrono::steady_clock;
+public:
+    virtual ~any_tsbpd() = default;
+
+    /// @see basic_tsbpd::on_ackack()
+    virtual long long on_ackack(unsigned timestamp_us, const rtt_sample& rtt, const steady_clock::time_point& recv_time_std) = 0;
+
+    virtual steady_clock::time_point get_pkt_time_base(uint32_t timestamp_us) const = 0;
+    virtual int64_t drift() const = 0;
+    virtual int64_t overdrift() const = 0;
+    virtual int64_t drift_estimate() const = 0;
+    virtual double skew_ppm() const = 0;
+    virtual double drift_estimate_stddev() const = 0;
+    virtual double skew_stddev_ppm() const = 0;
+};
+
+template <class TSBPD>
+class tsbpd_adapter final : public any_tsbpd
+{
+public:
+    explicit tsbpd_adapter(const tsbpd_options& options)
+        : m_tsbpd(options)
+    {
+    }
+
+    long long on_ackack(unsigned timestamp_us, const rtt_sample& rtt, const steady_clock::time_point& recv_time_std) override
+    {
+        return m_tsbpd.on_ackack(timestamp_us, rtt, recv_time_std);
+    }
+
+    steady_clock::time_point get_pkt_time_base(uint32_t timestamp_us) const override
+    {
+        return m_tsbpd.get_pkt_time_base(timestamp_us);
+    }
+
+    int64_t drift() const override { return m_tsbpd.drift(); }
+    int64_t overdrift() const override { return m_tsbpd.overdrift(); }
+    int64_t drift_estimate() const override { return m_tsbpd.drift_estimate(); }
+    double skew_ppm() const override { return m_tsbpd.skew_ppm(); }
+    double drift_estimate_stddev() const override { return m_tsbpd.drift_estimate_stddev(); }
+    double skew_stddev_ppm() const override { return m_tsbpd.skew_stddev_ppm(); }
+
+private:
+    TSBPD m_tsbpd;
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "tsbpd_dispatch.hpp"
+#include <fmt/ranges.h>
+
+using namespace std;
+
+drift_tracer_kind parse_drift_tracer(const string& name)
+{
+    return name == "median" ? drift_tracer_kind::median
+        : name == "kalman" ? drift_tracer_kind::kalman : drift_tracer_kind::mean;
+}
+
+string check_drift_tracer(drift_tracer_kind kind, unsigned max_span, int max_drift)
+{
+    using tsbpd_dispatch::index_of;
+    // The Kalman filter has no span.
+    if (kind != drift_tracer_kind::kalman && index_of(tsbpd_max_spans, max_span) == -1)
+        return fmt::format("MAX_SPAN {} is not supported, use one of {}", max_span, fmt::join(tsbpd_max_spans, ", "));
+    if (index_of(tsbpd_max_drifts, max_drift) == -1)
+        return fmt::format("MAX_DRIFT {} is not supported, use one of {}", max_drift, fmt::join(tsbpd_max_drifts, ", "));
+    return string();
+}
+
+unique_ptr<any_tsbpd> make_tsbpd(const tsbpd_options& options)
+{
+    return visit_drift_tracer(options.drift_tracer, options.max_span, options.max_drift,
+        [&options](auto tag) -> unique_ptr<any_tsbpd> {
+            return make_unique<tsbpd_adapter<basic_tsbpd<typename decltype(tag)::type>>>(options);
+        });
+}
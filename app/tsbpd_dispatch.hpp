@@ -0,0 +1,98 @@
+#pragma once
+#include "stdafx.hpp"
+#include <array>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "tsbpd.hpp"
+
+// The drift tracers take MAX_SPAN and MAX_DRIFT as template arguments, so that the divisors and the limits
+// are constants on the per-sample path. These values have a specialization each, selected at run time.
+constexpr unsigned tsbpd_max_spans[]  = {100, 200, 500, 1000, 2000, 5000, 10000};
+constexpr int      tsbpd_max_drifts[] = {1000, 2000, 2500, 5000, 10000, 20000};
+
+/// @param name mean, median or kalman (as in the command line options)
+drift_tracer_kind parse_drift_tracer(const std::string& name);
+
+/// @returns An error message if there is no specialization of the drift tracer for the values, or an empty string.
+std::string check_drift_tracer(drift_tracer_kind kind, unsigned max_span, int max_drift);
+
+/// Create the TSBPD state with the drift tracer of the options.
+/// @throws std::runtime_error if there is no specialization of the drift tracer for the options.
+std::unique_ptr<any_tsbpd> make_tsbpd(const tsbpd_options& options);
+
+template <typename T>
+struct type_tag
+{
+    using type = T;
+};
+
+namespace tsbpd_dispatch
+{
+
+template <typename T, size_t N>
+constexpr int index_of(const T (&values)[N], T value)
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (values[i] == value)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+template <unsigned MAX_SPAN, int MAX_DRIFT>
+using mean_drift_tracer = DriftTracer<MAX_SPAN, MAX_DRIFT>;
+
+template <unsigned MAX_SPAN, int MAX_DRIFT>
+using kalman_drift_tracer = KalmanDriftTracer<MAX_DRIFT>;
+
+template <class VISITOR, class DRIFT_TRACER>
+auto call(VISITOR& visitor)
+{
+    return visitor(type_tag<DRIFT_TRACER>());
+}
+
+template <class VISITOR>
+using result_t = decltype(std::declval<VISITOR&>()(type_tag<DriftTracer<tsbpd_max_spans[0], tsbpd_max_drifts[0]>>()));
+
+// Entry i is the specialization for tsbpd_max_spans[i / size(tsbpd_max_drifts)], tsbpd_max_drifts[i % size(tsbpd_max_drifts)].
+template <template <unsigned, int> class DRIFT_TRACER, class VISITOR, size_t... I>
+constexpr std::array<result_t<VISITOR> (*)(VISITOR&), sizeof...(I)> make_table(std::index_sequence<I...>)
+{
+    return {{&call<VISITOR, DRIFT_TRACER<tsbpd_max_spans[I / std::size(tsbpd_max_drifts)],
+        tsbpd_max_drifts[I % std::size(tsbpd_max_drifts)]>>...}};
+}
+
+template <template <unsigned, int> class DRIFT_TRACER, class VISITOR>
+constexpr auto table = make_table<DRIFT_TRACER, VISITOR>(
+    std::make_index_sequence<std::size(tsbpd_max_spans) * std::size(tsbpd_max_drifts)>());
+
+} // namespace tsbpd_dispatch
+
+/// Call @a visitor with type_tag<the specialization of the drift tracer> by a lookup in a table of functions.
+/// The Kalman tracer has no span: it is dispatched by @a max_drift only.
+/// @returns What the visitor returns.
+/// @throws std::runtime_error if there is no specialization for the values (see check_drift_tracer()).
+template <class VISITOR>
+auto visit_drift_tracer(drift_tracer_kind kind, unsigned max_span, int max_drift, VISITOR visitor)
+{
+    using namespace tsbpd_dispatch;
+    const std::string error = check_drift_tracer(kind, max_span, max_drift);
+    if (!error.empty())
+        throw std::runtime_error(error);
+
+    const int i_drift = index_of(tsbpd_max_drifts, max_drift);
+    const int i_span  = kind == drift_tracer_kind::kalman ? 0 : index_of(tsbpd_max_spans, max_span);
+    const int i       = i_span * static_cast<int>(std::size(tsbpd_max_drifts)) + i_drift;
+    switch (kind)
+    {
+    case drift_tracer_kind::median:
+        return table<MedianDriftTracer, VISITOR>[i](visitor);
+    case drift_tracer_kind::kalman:
+        return table<kalman_drift_tracer, VISITOR>[i](visitor);
+    default:
+        return table<mean_drift_tracer, VISITOR>[i](visitor);
+    }
+}
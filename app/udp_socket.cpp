@@ -1,10 +1,13 @@
 #include "stdafx.hpp"
+#include <algorithm>
 #include <memory.h>
 #include <set>
 #include <iostream>
 #include "udp_socket.hpp"
+#include "uring.hpp"
 
 using namespace std;
+using namespace std::chrono;
 using shared_udp = shared_ptr<socket_udp>;
 
 #ifndef _WIN32
@@ -15,6 +18,24 @@ using shared_udp = shared_ptr<socket_udp>;
 
 #define LOG_SOCK_UDP "[UDP] "
 
+/// @returns true if a non-blocking operation has nothing to do and can be retried later.
+static bool would_block(int err)
+{
+#ifndef _WIN32
+	return err == EAGAIN || err == EWOULDBLOCK;
+#else
+	return err == WSAEWOULDBLOCK;
+#endif
+}
+
+#if defined(__linux__)
+/// @returns true if the error is of the socket rather than of a datagram or its destination.
+static bool is_socket_error(int err)
+{
+	return err == EBADF || err == ENOTSOCK || err == EFAULT;
+}
+#endif
+
 sockaddr_any CreateAddr(const string& name, unsigned short port, int pref_family = AF_UNSPEC)
 {
 	// Handle empty name.
@@ -86,6 +107,23 @@ socket_udp::socket_udp(const UriParser &src_uri)
 	int yes = 1;
 	::setsockopt(m_bind_socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof yes);
 
+	// Several sockets can be bound to the same port, the kernel spreads the peers across them.
+	if (m_options.count("reuseport"))
+	{
+		const string reuseport = m_options.at("reuseport");
+		m_options.erase("reuseport");
+
+		if (reuseport == "yes" || reuseport == "true" || reuseport == "on" || reuseport == "1")
+		{
+#if defined(SO_REUSEPORT)
+			if (::setsockopt(m_bind_socket, SOL_SOCKET, SO_REUSEPORT, (const char *)&yes, sizeof yes) < 0)
+				throw runtime_error("Failed to set SO_REUSEPORT. Error code: " + to_string(NET_ERROR));
+#else
+			throw runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+		}
+	}
+
 #if defined(_WIN32)
 	unsigned long ulyes = 1;
 	if (ioctlsocket(m_bind_socket, FIONBIO, &ulyes) == SOCKET_ERROR)
@@ -96,6 +134,27 @@ socket_udp::socket_udp(const UriParser &src_uri)
 		throw runtime_error("UdpCommon::Setup: ioctl FIONBIO");
 	}
 
+	// Ask the kernel to attach the reception time to every datagram.
+#if defined(SO_TIMESTAMPNS)
+	if (::setsockopt(m_bind_socket, SOL_SOCKET, SO_TIMESTAMPNS, (const char *)&yes, sizeof yes) < 0)
+		spdlog::warn(LOG_SOCK_UDP "Failed to enable SO_TIMESTAMPNS, error {}. Kernel RX timestamps are not available.", NET_ERROR);
+#elif defined(SO_TIMESTAMP)
+	if (::setsockopt(m_bind_socket, SOL_SOCKET, SO_TIMESTAMP, (const char *)&yes, sizeof yes) < 0)
+		spdlog::warn(LOG_SOCK_UDP "Failed to enable SO_TIMESTAMP, error {}. Kernel RX timestamps are not available.", NET_ERROR);
+#endif
+
+#if defined(__linux__)
+	m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll_fd < 0)
+		throw runtime_error("Failed to create epoll. Error code: " + to_string(NET_ERROR));
+
+	epoll_event ev = {};
+	ev.events  = EPOLLIN | EPOLLET;
+	ev.data.fd = m_bind_socket;
+	if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_bind_socket, &ev) < 0)
+		throw runtime_error("Failed to add UDP socket to epoll. Error code: " + to_string(NET_ERROR));
+#endif
+
 	sockaddr_any sa_requested;
 	try
 	{
@@ -150,9 +209,38 @@ socket_udp::socket_udp(const UriParser &src_uri)
 		bind_me(reinterpret_cast<const sockaddr*>(&sa_requested));
 		spdlog::info("Binding to {}", sa_requested.str());
 	}
+
+	if (m_options.count("io"))
+	{
+		const string io = m_options.at("io");
+		m_options.erase("io");
+
+		if (io == "uring")
+		{
+#if ENABLE_IO_URING
+			m_uring = std::make_unique<udp_uring>(m_bind_socket);
+			spdlog::info(LOG_SOCK_UDP "Using io_uring.");
+#else
+			throw runtime_error("io_uring is not supported on this platform");
+#endif
+		}
+		else if (io != "epoll")
+		{
+			throw runtime_error("Unknown UDP I/O backend '" + io + "'. Expected 'epoll' or 'uring'.");
+		}
+	}
 }
 
-socket_udp::~socket_udp() { closesocket(m_bind_socket); }
+socket_udp::~socket_udp()
+{
+	// The rings reference the socket, release them first.
+	m_uring.reset();
+#if defined(__linux__)
+	if (m_epoll_fd >= 0)
+		::close(m_epoll_fd);
+#endif
+	closesocket(m_bind_socket);
+}
 
 sockaddr_any socket_udp::get_sockaddr() const
 {
@@ -168,136 +256,607 @@ sockaddr_any socket_udp::get_sockaddr() const
 	return addr;
 }
 
-size_t socket_udp::recv(const mut_bufv& buffer, int timeout_ms)
+bool socket_udp::wait_readable(int timeout_ms)
 {
-	while (!m_blocking_mode)
+#if defined(__linux__)
+	epoll_event ev = {};
+	int res = 0;
+	do
 	{
-		fd_set set;
-		timeval tv;
-		FD_ZERO(&set);
-		FD_SET(m_bind_socket, &set);
-		tv.tv_sec = 0;
-		tv.tv_usec = 10000;
-		const int select_ret = ::select((int)m_bind_socket + 1, &set, nullptr, &set, &tv);
-
-		if (select_ret != 0)    // ready
-			break;
+		res = ::epoll_wait(m_epoll_fd, &ev, 1, timeout_ms);
+	} while (res < 0 && errno == EINTR);
 
-		if (timeout_ms >= 0)   // timeout
-			return 0;
+	if (res < 0)
+	{
+		spdlog::error(LOG_SOCK_UDP "epoll_wait failed: error {0}.", errno);
+		throw runtime_error("udp::wait_readable::epoll_wait");
 	}
 
-	const int res =
-		::recvfrom(m_bind_socket, reinterpret_cast<char*>(buffer.data()), (int)buffer.size()
-			, 0, nullptr, nullptr);
-
-	if (res == -1)
-	{
-#ifndef _WIN32
-#define NET_ERROR errno
+	return res > 0;
 #else
-#define NET_ERROR WSAGetLastError()
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(m_bind_socket, &set);
+	timeval tv;
+	tv.tv_sec  = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	const int select_ret = ::select((int)m_bind_socket + 1, &set, nullptr, nullptr, timeout_ms < 0 ? nullptr : &tv);
+	return select_ret != 0;
 #endif
+}
+
+bool socket_udp::wait_writable(int timeout_ms)
+{
+	// Sending is rarely blocked on a UDP socket, so there is
+	// no point in keeping a readiness registration for it.
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(m_bind_socket, &set);
+	timeval tv;
+	tv.tv_sec  = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	const int select_ret = ::select((int)m_bind_socket + 1, nullptr, &set, nullptr, timeout_ms < 0 ? nullptr : &tv);
+	return select_ret != 0;
+}
+
+size_t socket_udp::recv(const mut_bufv& buffer, int timeout_ms)
+{
+	for (;;)
+	{
+		const int res =
+			::recvfrom(m_bind_socket, reinterpret_cast<char*>(buffer.data()), (int)buffer.size()
+				, 0, nullptr, nullptr);
+
+		if (res != -1)
+			return static_cast<size_t>(res);
+
 		const int err = NET_ERROR;
-		if (err != EAGAIN && err != EINTR && err != ECONNREFUSED)
+		if (would_block(err))
+		{
+			// Nothing pending: wait for the next datagram.
+			if (!wait_readable(timeout_ms))
+				return 0;
+			continue;
+		}
+
+		if (err != EINTR && err != ECONNREFUSED)
 			throw runtime_error("udp::recv::recv");
 
 		spdlog::info("UDP reading failed: error {0}. Again.", err);
 		return 0;
 	}
-
-	return static_cast<size_t>(res);
 }
 
 std::pair<size_t, sockaddr_any> socket_udp::recvfrom(const mut_bufv &buffer, int timeout_ms)
 {
-	typedef std::pair<size_t, sockaddr_any> return_pair;
-	while (!m_blocking_mode)
+	const datagram_info info = recvmsg(buffer, timeout_ms);
+	return std::make_pair(info.bytes, info.src_addr);
+}
+
+#if !defined(_WIN32)
+system_clock::time_point cmsg_kernel_timestamp(msghdr& mh)
+{
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr; cmsg = CMSG_NXTHDR(&mh, cmsg))
 	{
-		fd_set set;
-		timeval tv;
-		FD_ZERO(&set);
-		FD_SET(m_bind_socket, &set);
-		tv.tv_sec = 0;
-		tv.tv_usec = 10000;
-		const int select_ret = ::select((int)m_bind_socket + 1, &set, nullptr, &set, &tv);
-
-		if (select_ret != 0)    // ready
-			break;
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+#if defined(__linux__)
+		if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+		{
+			// ts[0] holds the software timestamp, ts[2] the hardware one.
+			scm_timestamping tss;
+			memcpy(&tss, CMSG_DATA(cmsg), sizeof tss);
+			if (tss.ts[0].tv_sec == 0 && tss.ts[0].tv_nsec == 0)
+				continue;
+			return system_clock::time_point(duration_cast<system_clock::duration>(seconds(tss.ts[0].tv_sec) + nanoseconds(tss.ts[0].tv_nsec)));
+		}
+#endif
 
-		if (timeout_ms >= 0)   // timeout
-			return return_pair();
+#if defined(SCM_TIMESTAMPNS)
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+			return system_clock::time_point(duration_cast<system_clock::duration>(seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec)));
+		}
+#elif defined(SCM_TIMESTAMP)
+		if (cmsg->cmsg_type == SCM_TIMESTAMP)
+		{
+			timeval tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof tv);
+			return system_clock::time_point(duration_cast<system_clock::duration>(seconds(tv.tv_sec) + microseconds(tv.tv_usec)));
+		}
+#endif
 	}
 
-	sockaddr_any peer_addr;
-	socklen_t addrlen = peer_addr.storage_size();
+	return system_clock::time_point();
+}
+#endif
 
-	const int res =
-		::recvfrom(m_bind_socket, reinterpret_cast<char*>(buffer.data()), (int)buffer.size()
-			, 0, peer_addr.get(), &addrlen);
+datagram_info socket_udp::recvmsg(const mut_bufv& buffer, int timeout_ms)
+{
+#if ENABLE_IO_URING
+	if (m_uring)
+	{
+		datagram_info info;
+		m_uring->recv(buf_view<const mut_bufv>(&buffer, 1), buf_view<datagram_info>(&info, 1), timeout_ms);
+		return info;
+	}
+#endif
 
-	if (res == -1)
+	for (;;)
 	{
-#ifndef _WIN32
-#define NET_ERROR errno
+		datagram_info info;
+#if !defined(_WIN32)
+		iovec iov;
+		iov.iov_base = buffer.data();
+		iov.iov_len  = buffer.size();
+
+		// Aligned storage for the ancillary data (timestamps).
+		alignas(cmsghdr) char control[256];
+
+		msghdr mh = {};
+		mh.msg_name       = info.src_addr.get();
+		mh.msg_namelen    = info.src_addr.storage_size();
+		mh.msg_iov        = &iov;
+		mh.msg_iovlen     = 1;
+		mh.msg_control    = control;
+		mh.msg_controllen = sizeof control;
+
+		const int res = (int) ::recvmsg(m_bind_socket, &mh, 0);
 #else
-#define NET_ERROR WSAGetLastError()
+		socklen_t addrlen = info.src_addr.storage_size();
+		const int res =
+			::recvfrom(m_bind_socket, reinterpret_cast<char*>(buffer.data()), (int)buffer.size()
+				, 0, info.src_addr.get(), &addrlen);
+#endif
+
+		if (res != -1)
+		{
+			info.bytes = static_cast<size_t>(res);
+#if !defined(_WIN32)
+			info.src_addr.len = mh.msg_namelen;
+			info.kernel_time_sys = cmsg_kernel_timestamp(mh);
+#else
+			info.src_addr.len = addrlen;
 #endif
+			return info;
+		}
+
 		const int err = NET_ERROR;
-		if (err != EAGAIN && err != EINTR && err != ECONNREFUSED)
+		if (would_block(err))
+		{
+			// Nothing pending: wait for the next datagram.
+			if (!wait_readable(timeout_ms))
+				return datagram_info();
+			continue;
+		}
+
+		if (err != EINTR && err != ECONNREFUSED)
 		{
 			spdlog::error("UDP reading failed: error {0}.", err);
 			throw runtime_error("udp::recv::recv");
 		}
 
 		spdlog::info("UDP reading failed: error {0}. Again.", err);
-		return return_pair();
+		return datagram_info();
 	}
-
-	return return_pair(static_cast<size_t>(res), peer_addr);
 }
 
-int socket_udp::sendto(const sockaddr_any& dst_addr, const const_bufv& buffer, int timeout_ms)
+size_t socket_udp::recvmmsg(buf_view<const mut_bufv> buffers, buf_view<datagram_info> infos, int timeout_ms)
 {
-	while (!m_blocking_mode)
+	const size_t count = std::min(buffers.size(), infos.size());
+	if (count == 0)
+		return 0;
+
+#if ENABLE_IO_URING
+	if (m_uring)
+		return m_uring->recv(buf_view<const mut_bufv>(buffers.data(), count), buf_view<datagram_info>(infos.data(), count), timeout_ms);
+#endif
+
+#if defined(__linux__)
+	// At most max_batch datagrams are received to keep the message headers on the stack.
+	const size_t n = std::min(count, max_batch);
+	array<mmsghdr, max_batch> msgs;
+	array<iovec, max_batch>   iovs;
+	alignas(cmsghdr) char control[max_batch][128];
+
+	for (size_t i = 0; i < n; ++i)
 	{
-		fd_set set;
-		timeval tv;
-		FD_ZERO(&set);
-		FD_SET(m_bind_socket, &set);
-		tv.tv_sec = 0;
-		tv.tv_usec = 10000;
-		const int select_ret = ::select((int)m_bind_socket + 1, nullptr, &set, &set, &tv);
-
-		if (select_ret != 0)    // ready
+		infos.data()[i] = datagram_info();
+		iovs[i].iov_base = buffers.data()[i].data();
+		iovs[i].iov_len  = buffers.data()[i].size();
+
+		msghdr& mh = msgs[i].msg_hdr;
+		mh = msghdr();
+		mh.msg_name       = infos.data()[i].src_addr.get();
+		mh.msg_namelen    = infos.data()[i].src_addr.storage_size();
+		mh.msg_iov        = &iovs[i];
+		mh.msg_iovlen     = 1;
+		mh.msg_control    = control[i];
+		mh.msg_controllen = sizeof control[i];
+		msgs[i].msg_len   = 0;
+	}
+
+	for (;;)
+	{
+		const int res = ::recvmmsg(m_bind_socket, msgs.data(), (unsigned) n, 0, nullptr);
+		if (res > 0)
+		{
+			for (int i = 0; i < res; ++i)
+			{
+				datagram_info& info  = infos.data()[i];
+				info.bytes           = msgs[i].msg_len;
+				info.src_addr.len    = msgs[i].msg_hdr.msg_namelen;
+				info.kernel_time_sys = cmsg_kernel_timestamp(msgs[i].msg_hdr);
+			}
+			return static_cast<size_t>(res);
+		}
+
+		const int err = res == 0 ? EAGAIN : NET_ERROR;
+		if (would_block(err))
+		{
+			// Nothing pending: wait for the next datagram.
+			if (!wait_readable(timeout_ms))
+				return 0;
+			continue;
+		}
+
+		if (err != EINTR && err != ECONNREFUSED)
+		{
+			spdlog::error("UDP reading failed: error {0}.", err);
+			throw runtime_error("udp::recv::recvmmsg");
+		}
+
+		spdlog::info("UDP reading failed: error {0}. Again.", err);
+		return 0;
+	}
+#else
+	// No batch receiving: wait for the first datagram, then take whatever is already pending.
+	size_t received = 0;
+	while (received < count)
+	{
+		infos.data()[received] = recvmsg(buffers.data()[received], received == 0 ? timeout_ms : 0);
+		if (infos.data()[received].bytes == 0 && infos.data()[received].src_addr.empty())
 			break;
+		++received;
+	}
+	return received;
+#endif
+}
+
+size_t socket_udp::sendmmsg(buf_view<const sockaddr_any> dst_addrs, buf_view<const const_bufv> buffers, buf_view<int> errors,
+	buf_view<uint32_t> tskeys)
+{
+	const size_t count = std::min({dst_addrs.size(), buffers.size(), errors.size()});
+	const bool request_tx_timestamps = tskeys.size() != 0;
+	std::fill(errors.data(), errors.data() + count, -1);
 
-		if (timeout_ms >= 0)   // timeout
-			return 0;
+#if ENABLE_IO_URING
+	if (m_uring)
+	{
+		const size_t sent = m_uring->send(buf_view<const sockaddr_any>(dst_addrs.data(), count),
+			buf_view<const const_bufv>(buffers.data(), count), buf_view<int>(errors.data(), count), request_tx_timestamps);
+		// Timestamp keys are assigned by the kernel in the order the datagrams are sent.
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (errors.data()[i] != 0)
+			{
+				log_send_error(dst_addrs.data()[i], errors.data()[i]);
+				continue;
+			}
+			if (request_tx_timestamps && i < tskeys.size())
+				tskeys.data()[i] = m_tx_tskey;
+			if (request_tx_timestamps)
+				++m_tx_tskey;
+		}
+		return sent;
 	}
+#endif
 
-	const int res = ::sendto(m_bind_socket,
-		reinterpret_cast<const char*>(buffer.data()),
-		(int)buffer.size(),
-		0,
-		dst_addr.get(),
-		dst_addr.size());
-	if (res == -1)
+	size_t sent = 0;
+
+#if defined(__linux__)
+	array<mmsghdr, max_batch> msgs;
+	array<iovec, max_batch>   iovs;
+	alignas(cmsghdr) char control[max_batch][CMSG_SPACE(sizeof(uint32_t))];
+
+	// The datagrams up to next are sent or have failed.
+	size_t next = 0;
+	while (next < count)
 	{
-#ifndef _WIN32
-#define NET_ERROR errno
+		const size_t n = std::min(count - next, max_batch);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const const_bufv&   buf  = buffers.data()[next + i];
+			const sockaddr_any& addr = dst_addrs.data()[next + i];
+			iovs[i].iov_base = const_cast<uint8_t*>(buf.data());
+			iovs[i].iov_len  = buf.size();
+
+			msghdr& mh = msgs[i].msg_hdr;
+			mh = msghdr();
+			mh.msg_name    = const_cast<sockaddr*>(addr.get());
+			mh.msg_namelen = addr.size();
+			mh.msg_iov     = &iovs[i];
+			mh.msg_iovlen  = 1;
+			msgs[i].msg_len = 0;
+
+			if (request_tx_timestamps)
+			{
+				memset(control[i], 0, sizeof control[i]);
+				mh.msg_control    = control[i];
+				mh.msg_controllen = sizeof control[i];
+
+				cmsghdr* cmsg    = CMSG_FIRSTHDR(&mh);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type  = SO_TIMESTAMPING;
+				cmsg->cmsg_len   = CMSG_LEN(sizeof(uint32_t));
+				const uint32_t tsflags = SOF_TIMESTAMPING_TX_SOFTWARE;
+				memcpy(CMSG_DATA(cmsg), &tsflags, sizeof tsflags);
+			}
+		}
+
+		const int res = ::sendmmsg(m_bind_socket, msgs.data(), (unsigned) n, 0);
+		if (res > 0)
+		{
+			// Timestamp keys are assigned by the kernel in the order the datagrams are sent.
+			for (int i = 0; i < res; ++i)
+			{
+				errors.data()[next + i] = 0;
+				if (request_tx_timestamps && next + i < tskeys.size())
+					tskeys.data()[next + i] = m_tx_tskey;
+				if (request_tx_timestamps)
+					++m_tx_tskey;
+			}
+			sent += res;
+			next += res;
+			continue;
+		}
+
+		const int err = NET_ERROR;
+		if (would_block(err))
+		{
+			if (!wait_writable(-1))
+				break;
+			continue;
+		}
+
+		if (is_socket_error(err))
+		{
+			spdlog::error("UDP sending failed: error {0}.", err);
+			throw runtime_error("udp::send::sendmmsg");
+		}
+
+		// sendmmsg stops at the first datagram that fails. Skip it and send the rest.
+		// A datagram failing this early (e.g. no route) takes no TX timestamp key.
+		errors.data()[next] = err;
+		log_send_error(dst_addrs.data()[next], err);
+		++next;
+	}
 #else
-#define NET_ERROR WSAGetLastError()
+	for (; sent < count; ++sent)
+	{
+		uint32_t tskey = 0;
+		const int res = request_tx_timestamps
+			? sendto_timestamped(dst_addrs.data()[sent], buffers.data()[sent], tskey)
+			: sendto(dst_addrs.data()[sent], buffers.data()[sent]);
+		if (res <= 0)
+			break;
+		errors.data()[sent] = 0;
+		if (sent < tskeys.size())
+			tskeys.data()[sent] = tskey;
+	}
 #endif
+
+	return sent;
+}
+
+void socket_udp::log_send_error(const sockaddr_any& dst_addr, int err)
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (m_send_errors > 0 && now - m_send_error_time < std::chrono::seconds(1))
+	{
+		++m_send_errors;
+		return;
+	}
+
+	// The first error is logged right away, the following ones are counted for a second.
+	if (m_send_errors > 1)
+		spdlog::warn(LOG_SOCK_UDP "Sending to {} failed: error {}. {} more failures since the last report.", dst_addr.str(), err,
+			m_send_errors - 1);
+	else
+		spdlog::warn(LOG_SOCK_UDP "Sending to {} failed: error {}.", dst_addr.str(), err);
+	m_send_errors     = 1;
+	m_send_error_time = now;
+}
+
+int socket_udp::sendto(const sockaddr_any& dst_addr, const const_bufv& buffer, int timeout_ms)
+{
+#if ENABLE_IO_URING
+	if (m_uring)
+	{
+		int error = 0;
+		m_uring->send(buf_view<const sockaddr_any>(&dst_addr, 1), buf_view<const const_bufv>(&buffer, 1), buf_view<int>(&error, 1), false);
+		if (error == 0)
+			return (int) buffer.size();
+
+		spdlog::error("UDP sending failed: error {0}.", error);
+		throw runtime_error("udp::send::uring");
+	}
+#endif
+
+	for (;;)
+	{
+		const int res = ::sendto(m_bind_socket,
+			reinterpret_cast<const char*>(buffer.data()),
+			(int)buffer.size(),
+			0,
+			dst_addr.get(),
+			dst_addr.size());
+
+		if (res != -1)
+			return static_cast<size_t>(res);
+
 		const int err = NET_ERROR;
+		if (would_block(err))
+		{
+			if (!wait_writable(timeout_ms))
+				return 0;
+			continue;
+		}
+
 		spdlog::error("UDP sending failed: error {0}.", err);
 		throw runtime_error("udp::send::send");
 	}
-
-	return static_cast<size_t>(res);
 }
 
 int socket_udp::send(const const_bufv &buffer, int timeout_ms)
 {
 	return sendto(m_dst_addr, buffer, timeout_ms);
 }
+
+int socket_udp::rx_event_fd() const
+{
+#if ENABLE_IO_URING
+	// The ring becomes readable when there are completions of the multishot receive.
+	if (m_uring)
+		return m_uring->rx_fd();
+#endif
+	return (int) m_bind_socket;
+}
+
+bool socket_udp::enable_tx_timestamps()
+{
+#if defined(__linux__)
+	// Only report flags are set on the socket. Generation of a TX timestamp is requested
+	// per datagram in sendto_timestamped(), so other datagrams do not consume timestamp keys.
+	const int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	if (::setsockopt(m_bind_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof flags) < 0)
+	{
+		spdlog::warn(LOG_SOCK_UDP "Failed to enable SO_TIMESTAMPING, error {}.", NET_ERROR);
+		return false;
+	}
+
+	m_tx_tskey = 0; // Setting SOF_TIMESTAMPING_OPT_ID resets the key counter.
+	return true;
+#else
+	spdlog::warn(LOG_SOCK_UDP "Kernel TX timestamps are not supported on this platform.");
+	return false;
+#endif
+}
+
+int socket_udp::sendto_timestamped(const sockaddr_any& dst_addr, const const_bufv& buffer, uint32_t& tskey)
+{
+#if ENABLE_IO_URING
+	if (m_uring)
+	{
+		int error = 0;
+		m_uring->send(buf_view<const sockaddr_any>(&dst_addr, 1), buf_view<const const_bufv>(&buffer, 1), buf_view<int>(&error, 1), true);
+		if (error != 0)
+		{
+			spdlog::error("UDP sending failed: error {0}.", error);
+			throw runtime_error("udp::send::uring");
+		}
+		tskey = m_tx_tskey++;
+		return (int) buffer.size();
+	}
+#endif
+
+#if defined(__linux__)
+	iovec iov;
+	iov.iov_base = const_cast<uint8_t*>(buffer.data());
+	iov.iov_len  = buffer.size();
+
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t))] = {};
+
+	msghdr mh = {};
+	mh.msg_name       = const_cast<sockaddr*>(dst_addr.get());
+	mh.msg_namelen    = dst_addr.size();
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = control;
+	mh.msg_controllen = sizeof control;
+
+	cmsghdr* cmsg    = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SO_TIMESTAMPING;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(uint32_t));
+	const uint32_t tsflags = SOF_TIMESTAMPING_TX_SOFTWARE;
+	memcpy(CMSG_DATA(cmsg), &tsflags, sizeof tsflags);
+
+	for (;;)
+	{
+		const int res = (int) ::sendmsg(m_bind_socket, &mh, 0);
+		if (res != -1)
+		{
+			tskey = m_tx_tskey++;
+			return res;
+		}
+
+		const int err = NET_ERROR;
+		if (would_block(err))
+		{
+			if (!wait_writable(-1))
+				return 0;
+			continue;
+		}
+
+		spdlog::error("UDP sending failed: error {0}.", err);
+		throw runtime_error("udp::send::send");
+	}
+#else
+	tskey = m_tx_tskey++;
+	return sendto(dst_addr, buffer);
+#endif
+}
+
+bool socket_udp::read_tx_timestamp(uint32_t& tskey, system_clock::time_point& tx_time_sys)
+{
+#if defined(__linux__)
+	for (;;)
+	{
+		// The datagram itself is not looped back (SOF_TIMESTAMPING_OPT_TSONLY),
+		// only the ancillary data is of interest.
+		alignas(cmsghdr) char control[256];
+
+		msghdr mh = {};
+		mh.msg_control    = control;
+		mh.msg_controllen = sizeof control;
+
+		const int res = (int) ::recvmsg(m_bind_socket, &mh, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (res == -1)
+		{
+			const int err = NET_ERROR;
+			if (err == EINTR)
+				continue;
+			if (!would_block(err))
+				spdlog::warn(LOG_SOCK_UDP "Reading the error queue failed: error {}.", err);
+			return false;
+		}
+
+		const sock_extended_err* serr = nullptr;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr; cmsg = CMSG_NXTHDR(&mh, cmsg))
+		{
+			if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+				|| (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			{
+				serr = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+			}
+		}
+
+		// Skip anything that is not a TX timestamp.
+		if (serr == nullptr || serr->ee_errno != ENOMSG || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+			continue;
+
+		tx_time_sys = cmsg_kernel_timestamp(mh);
+		if (tx_time_sys == system_clock::time_point())
+			continue;
+
+		tskey = serr->ee_data;
+		return true;
+	}
+#else
+	return false;
+#endif
+}
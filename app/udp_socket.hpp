@@ -1,5 +1,7 @@
 #pragma once
 #include <map>
+#include <memory>
+#include <chrono>
 #include <future>
 #include <string>
 
@@ -11,11 +13,38 @@
 
 #if !defined(_WIN32)
 #include <sys/ioctl.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
 typedef int SOCKET;
 #define INVALID_SOCKET ((SOCKET)-1)
 #define closesocket close
 #endif
 
+/// Details of a received datagram.
+struct datagram_info
+{
+	size_t       bytes = 0;
+	sockaddr_any src_addr;
+	/// Kernel (software) reception timestamp. Zero if the kernel did not provide one.
+	std::chrono::system_clock::time_point kernel_time_sys;
+};
+
+#if !defined(_WIN32)
+/// Extract the kernel (software) timestamp from the ancillary data of a message.
+/// @returns Zero time point if there is no timestamp.
+std::chrono::system_clock::time_point cmsg_kernel_timestamp(msghdr& mh);
+#endif
+
+class udp_uring;
+
+/// UDP socket.
+/// The I/O backend is selected with the "io" URI option:
+///  - "epoll" (default) - non-blocking system calls, readiness is waited on with epoll (select on other platforms);
+///  - "uring" - io_uring (Linux only), see udp_uring.
+/// The "reuseport=yes" URI option allows several sockets to bind to the same port (SO_REUSEPORT).
 class socket_udp
 	: public std::enable_shared_from_this<socket_udp>
 {
@@ -38,22 +67,117 @@ public:
 
 public:
 	/**
-	 * @returns The number of bytes received.
+	 * Receive a datagram. The socket is read first, and waited on only
+	 * if there is nothing pending (edge-triggered epoll on Linux).
+	 *
+	 * @param timeout_ms time to wait for the socket to become readable:
+	 *        -1 blocks until a datagram arrives, 0 does not wait.
+	 *
+	 * @returns The number of bytes received and the source address,
+	 *          or zero bytes and an empty address on timeout.
 	 *
 	 * @throws socket_exception Thrown on failure.
 	 */
 	std::pair<size_t, sockaddr_any>
 	       recvfrom(const mut_bufv &buffer, int timeout_ms = -1);
 
+	/**
+	 * Same as recvfrom(), but also returns the time the datagram
+	 * was received by the kernel (SO_TIMESTAMPNS), if available.
+	 *
+	 * @throws socket_exception Thrown on failure.
+	 */
+	datagram_info recvmsg(const mut_bufv& buffer, int timeout_ms = -1);
+
+	/// Maximum number of datagrams passed to the kernel in one batch call.
+	static constexpr size_t max_batch = 64;
+
+	/**
+	 * Receive a burst of datagrams in one call (recvmmsg on Linux).
+	 * Waits for the first datagram, and then takes only those already pending,
+	 * but not more than max_batch.
+	 *
+	 * @param buffers buffers to receive datagrams into, one per datagram.
+	 * @param infos   [out] details of each received datagram, same order as @a buffers.
+	 *
+	 * @returns The number of datagrams received, 0 on timeout.
+	 *
+	 * @throws socket_exception Thrown on failure.
+	 */
+	size_t recvmmsg(buf_view<const mut_bufv> buffers, buf_view<datagram_info> infos, int timeout_ms = -1);
+
+	/**
+	 * Send datagrams, each to its own destination, in one call (sendmmsg on Linux).
+	 * A datagram that can't be sent (e.g. the destination is unreachable) is skipped, the error is logged
+	 * (at most once per second) and the others are sent. Must be called from one thread only.
+	 *
+	 * @param dst_addrs destination of each datagram.
+	 * @param buffers   datagrams to send.
+	 * @param errors    [out] per datagram: 0 if it was sent, otherwise the error it failed with
+	 *                  (-1 if it was not attempted).
+	 * @param tskeys    [out] if not empty, kernel TX timestamps are requested for the datagrams
+	 *                  and the keys of the ones sent are returned here (see sendto_timestamped()).
+	 *
+	 * @returns The number of datagrams sent.
+	 *
+	 * @throws socket_exception Thrown on a failure of the socket.
+	 */
+	size_t sendmmsg(buf_view<const sockaddr_any> dst_addrs, buf_view<const const_bufv> buffers, buf_view<int> errors,
+		buf_view<uint32_t> tskeys = buf_view<uint32_t>());
+
 	size_t recv  (const mut_bufv& buffer, int timeout_ms);
 	int    send  (const const_bufv &buffer, int timeout_ms = -1);
 	int    sendto(const sockaddr_any& dst_addr, const const_bufv& buffer, int timeout_ms = -1);
 
+public:
+	/// File descriptor to poll for incoming datagrams (POLLIN),
+	/// e.g. to combine the socket with other events in one event loop.
+	/// Level-triggered: readable while recvmmsg() has something to return.
+	int rx_event_fd() const;
+
+	/// Enable kernel software TX timestamps (SO_TIMESTAMPING) for datagrams
+	/// sent with sendto_timestamped().
+	/// @returns false if TX timestamps are not supported.
+	bool enable_tx_timestamps();
+
+	/// Send a datagram and request its kernel TX timestamp.
+	/// @param [out] tskey the key to match the timestamp returned by read_tx_timestamp().
+	/// @returns The number of bytes sent.
+	///
+	/// @throws socket_exception Thrown on failure.
+	int sendto_timestamped(const sockaddr_any& dst_addr, const const_bufv& buffer, uint32_t& tskey);
+
+	/// Read a pending TX timestamp from the socket error queue. Does not wait.
+	/// @param [out] tskey the key returned by sendto_timestamped() for the datagram.
+	/// @param [out] tx_time_sys the time the datagram was passed to the network device (system clock).
+	/// @returns false if there are no TX timestamps pending.
+	bool read_tx_timestamp(uint32_t& tskey, std::chrono::system_clock::time_point& tx_time_sys);
+
+private:
+	/// Wait for the socket to become readable.
+	/// @returns false on timeout.
+	bool wait_readable(int timeout_ms);
+
+	/// Wait for the socket to become writable.
+	/// @returns false on timeout.
+	bool wait_writable(int timeout_ms);
+
+	/// Log a datagram sendmmsg() failed to send, at most once per second.
+	void log_send_error(const sockaddr_any& dst_addr, int err);
+
 private:
 	SOCKET m_bind_socket = -1; // INVALID_SOCK;
+#if defined(__linux__)
+	int    m_epoll_fd    = -1; // Edge-triggered read readiness of m_bind_socket.
+#endif
+
+	std::unique_ptr<udp_uring> m_uring; // io_uring backend, if selected
 
 	std::atomic<sockaddr_any> m_dst_addr;
-	const bool m_blocking_mode = false;
+	uint32_t m_tx_tskey = 0; // The key of the next TX timestamp (SOF_TIMESTAMPING_OPT_ID).
+
+	std::chrono::steady_clock::time_point m_send_error_time; // When a sendmmsg() error was last logged.
+	size_t m_send_errors = 0;                                 // Errors not logged since then.
 
 	string                   m_host;
 	int                      m_port;
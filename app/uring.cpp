@@ -0,0 +1,440 @@
+#include "stdafx.hpp"
+#include "uring.hpp"
+
+#if ENABLE_IO_URING
+#include <algorithm>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/net_tstamp.h>
+
+#include "udp_socket.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+#define LOG_URING "[URING] "
+
+namespace
+{
+int sys_io_uring_setup(unsigned entries, io_uring_params* p)
+{
+	return (int) ::syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz)
+{
+	return (int) ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+// The rings are shared with the kernel.
+inline unsigned load_acquire(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void store_release(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+} // namespace
+
+uring::uring(unsigned entries, unsigned cq_entries)
+{
+	io_uring_params p = {};
+	p.flags      = IORING_SETUP_CQSIZE;
+	p.cq_entries = cq_entries;
+
+	m_fd = sys_io_uring_setup(entries, &p);
+	if (m_fd < 0)
+		throw runtime_error("io_uring_setup failed. Error code: " + to_string(errno));
+
+	if (!(p.features & IORING_FEAT_EXT_ARG))
+	{
+		::close(m_fd);
+		throw runtime_error("io_uring: the kernel does not support waiting with a timeout (IORING_FEAT_EXT_ARG)");
+	}
+
+	m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		m_sq_size = m_cq_size = max(m_sq_size, m_cq_size);
+
+	m_sq_ptr = ::mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (m_sq_ptr == MAP_FAILED)
+	{
+		::close(m_fd);
+		throw runtime_error("io_uring: failed to map the submission queue");
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cq_ptr = m_sq_ptr;
+	}
+	else
+	{
+		m_cq_ptr = ::mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (m_cq_ptr == MAP_FAILED)
+		{
+			::munmap(m_sq_ptr, m_sq_size);
+			::close(m_fd);
+			throw runtime_error("io_uring: failed to map the completion queue");
+		}
+	}
+
+	m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+	m_sqes = static_cast<io_uring_sqe*>(
+		::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+	if (m_sqes == MAP_FAILED)
+	{
+		if (m_cq_ptr != m_sq_ptr)
+			::munmap(m_cq_ptr, m_cq_size);
+		::munmap(m_sq_ptr, m_sq_size);
+		::close(m_fd);
+		throw runtime_error("io_uring: failed to map the submission queue entries");
+	}
+
+	char* sq = static_cast<char*>(m_sq_ptr);
+	m_sq_head  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+	m_sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+	m_sq_mask  = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+	m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+	char* cq = static_cast<char*>(m_cq_ptr);
+	m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+	m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+	m_cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+	m_cqes    = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+}
+
+uring::~uring()
+{
+	::munmap(m_sqes, m_sqes_size);
+	if (m_cq_ptr != m_sq_ptr)
+		::munmap(m_cq_ptr, m_cq_size);
+	::munmap(m_sq_ptr, m_sq_size);
+	::close(m_fd);
+}
+
+io_uring_sqe* uring::get_sqe()
+{
+	const unsigned tail = *m_sq_tail;
+	if (tail - load_acquire(m_sq_head) > m_sq_mask)
+		return nullptr;
+
+	const unsigned idx = tail & m_sq_mask;
+	io_uring_sqe* sqe = &m_sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	m_sq_array[idx] = idx;
+	store_release(m_sq_tail, tail + 1);
+	++m_to_submit;
+	return sqe;
+}
+
+io_uring_sqe* uring::get_sqe_or_submit()
+{
+	io_uring_sqe* sqe = get_sqe();
+	if (!sqe)
+	{
+		submit_and_wait(0);
+		sqe = get_sqe();
+	}
+	if (!sqe)
+		throw runtime_error("io_uring: the submission queue is full. Pending entries: " + to_string(m_to_submit));
+	return sqe;
+}
+
+bool uring::submit_and_wait(unsigned min_complete, int timeout_ms)
+{
+	__kernel_timespec ts = {};
+	ts.tv_sec  = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+	io_uring_getevents_arg arg = {};
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts         = timeout_ms >= 0 ? reinterpret_cast<uint64_t>(&ts) : 0;
+
+	const unsigned flags = min_complete > 0 ? (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG) : 0;
+	for (;;)
+	{
+		const int res = sys_io_uring_enter(m_fd, m_to_submit, min_complete, flags,
+			flags ? &arg : nullptr, flags ? sizeof arg : 0);
+		if (res >= 0)
+		{
+			m_to_submit -= min((unsigned) res, m_to_submit);
+			if (m_to_submit == 0)
+				return true;
+			continue; // Not everything was submitted, e.g. the CQ was full.
+		}
+
+		if (errno == ETIME)
+			return false;
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno == EBUSY || errno == EAGAIN)
+		{
+			// Completions have to be reaped before more can be submitted.
+			return true;
+		}
+
+		throw runtime_error("io_uring_enter failed. Error code: " + to_string(errno));
+	}
+}
+
+const io_uring_cqe* uring::peek_cqe() const
+{
+	const unsigned head = *m_cq_head;
+	if (head == load_acquire(m_cq_tail))
+		return nullptr;
+
+	return &m_cqes[head & m_cq_mask];
+}
+
+void uring::cqe_seen()
+{
+	store_release(m_cq_head, *m_cq_head + 1);
+}
+
+void uring::provide_buffers(unsigned short bgid, unsigned count, size_t buf_size)
+{
+	m_bgid     = bgid;
+	m_buf_size = buf_size;
+	m_buf_storage.assign(count * buf_size, 0);
+
+	io_uring_sqe* sqe = get_sqe_or_submit();
+
+	sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd        = (int) count;
+	sqe->addr      = reinterpret_cast<uint64_t>(m_buf_storage.data());
+	sqe->len       = (unsigned) buf_size;
+	sqe->off       = 0; // the first buffer ID
+	sqe->buf_group = bgid;
+	submit_and_wait(1);
+
+	const io_uring_cqe* cqe = peek_cqe();
+	const int res = cqe ? cqe->res : -EIO;
+	if (cqe)
+		cqe_seen();
+	if (res < 0)
+		throw runtime_error("io_uring: failed to provide buffers. Error code: " + to_string(-res));
+}
+
+void uring::recycle_buffer(unsigned bid)
+{
+	io_uring_sqe* sqe = get_sqe_or_submit();
+
+	sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd        = 1;
+	sqe->addr      = reinterpret_cast<uint64_t>(buffer(bid));
+	sqe->len       = (unsigned) m_buf_size;
+	sqe->off       = bid;
+	sqe->buf_group = m_bgid;
+	// Only a failure is worth a completion.
+	sqe->flags     = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+udp_uring::udp_uring(int sock)
+	: m_sock(sock)
+	, m_rx(socket_udp::max_batch, 1024)
+	, m_rx_msg()
+	, m_tx(socket_udp::max_batch, 2 * socket_udp::max_batch)
+{
+	// A buffer holds the recvmsg header, the source address, the ancillary data and the payload (up to MTU).
+	m_rx.provide_buffers(rx_bgid, 256, sizeof(io_uring_recvmsg_out) + rx_name_size + rx_control_size + 1500);
+
+	m_rx_msg.msg_namelen    = rx_name_size;
+	m_rx_msg.msg_controllen = rx_control_size;
+	arm_recv();
+	m_rx.submit_and_wait(0);
+}
+
+void udp_uring::arm_recv()
+{
+	// Buffer recycling may have filled the queue. Waiting for datagrams without the request would only time out.
+	io_uring_sqe* sqe = m_rx.get_sqe_or_submit();
+
+	sqe->opcode    = IORING_OP_RECVMSG;
+	sqe->fd        = m_sock;
+	sqe->addr      = reinterpret_cast<uint64_t>(&m_rx_msg);
+	sqe->len       = 1;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = rx_bgid;
+	sqe->user_data = rx_user_data;
+	m_rx_armed = true;
+}
+
+size_t udp_uring::recv(buf_view<const mut_bufv> buffers, buf_view<datagram_info> infos, int timeout_ms)
+{
+	const size_t count = std::min(buffers.size(), infos.size());
+	size_t received = 0;
+
+	while (received < count)
+	{
+		const io_uring_cqe* cqe = m_rx.peek_cqe();
+		if (!cqe)
+		{
+			// Enter the kernel only if there is nothing to take from the completion queue.
+			if (received > 0)
+				break;
+			if (!m_rx_armed)
+				arm_recv();
+			if (!m_rx.submit_and_wait(1, timeout_ms))
+				break;
+			continue;
+		}
+
+		const int      res   = cqe->res;
+		const unsigned flags = cqe->flags;
+		const uint64_t user_data = cqe->user_data;
+		m_rx.cqe_seen();
+
+		if (user_data != rx_user_data)
+		{
+			// A buffer could not be given back to the kernel.
+			spdlog::warn(LOG_URING "Recycling a receive buffer failed: error {}.", -res);
+			continue;
+		}
+
+		// The multishot request has terminated (e.g. no buffers were left). Post it again.
+		if (!(flags & IORING_CQE_F_MORE))
+			m_rx_armed = false;
+
+		if (res < 0)
+		{
+			if (res == -ENOBUFS || res == -EINTR || res == -ECONNREFUSED)
+				continue;
+			spdlog::error(LOG_URING "Receiving failed: error {}.", -res);
+			throw runtime_error("udp::recv::uring");
+		}
+
+		if (!(flags & IORING_CQE_F_BUFFER))
+			continue;
+
+		const unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		const uint8_t* buf = m_rx.buffer(bid);
+		io_uring_recvmsg_out out;
+		memcpy(&out, buf, sizeof out);
+
+		const uint8_t* name    = buf + sizeof out;
+		uint8_t*       control = const_cast<uint8_t*>(name + rx_name_size);
+		const uint8_t* payload = control + rx_control_size;
+
+		datagram_info& info = infos.data()[received];
+		info = datagram_info();
+		info.src_addr.set(reinterpret_cast<const sockaddr*>(name), (sockaddr_any::syslen_t) out.namelen);
+
+		msghdr mh = {};
+		mh.msg_control    = control;
+		mh.msg_controllen = min<size_t>(out.controllen, rx_control_size);
+		info.kernel_time_sys = cmsg_kernel_timestamp(mh);
+
+		const mut_bufv& dst = buffers.data()[received];
+		info.bytes = min<size_t>(out.payloadlen, dst.size());
+		memcpy(dst.data(), payload, info.bytes);
+
+		m_rx.recycle_buffer(bid);
+		++received;
+	}
+
+	if (!m_rx_armed)
+	{
+		arm_recv();
+		m_rx.submit_and_wait(0);
+	}
+
+	return received;
+}
+
+size_t udp_uring::send(buf_view<const sockaddr_any> dst_addrs, buf_view<const const_bufv> buffers, buf_view<int> errors,
+	bool tx_timestamps)
+{
+	const size_t count = std::min({dst_addrs.size(), buffers.size(), errors.size()});
+	const size_t batch = socket_udp::max_batch;
+
+	array<msghdr, batch> msgs;
+	array<iovec, batch>  iovs;
+	alignas(cmsghdr) char control[batch][CMSG_SPACE(sizeof(uint32_t))];
+
+	lock_guard<mutex> lck(m_tx_mtx);
+	size_t sent = 0;
+	for (size_t first = 0; first < count; first += batch)
+	{
+		const size_t n = std::min(count - first, batch);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const const_bufv&   buf  = buffers.data()[first + i];
+			const sockaddr_any& addr = dst_addrs.data()[first + i];
+			errors.data()[first + i] = ECANCELED; // until the completion says otherwise
+			iovs[i].iov_base = const_cast<uint8_t*>(buf.data());
+			iovs[i].iov_len  = buf.size();
+
+			msghdr& mh = msgs[i];
+			mh = msghdr();
+			mh.msg_name    = const_cast<sockaddr*>(addr.get());
+			mh.msg_namelen = addr.size();
+			mh.msg_iov     = &iovs[i];
+			mh.msg_iovlen  = 1;
+
+			if (tx_timestamps)
+			{
+				memset(control[i], 0, sizeof control[i]);
+				mh.msg_control    = control[i];
+				mh.msg_controllen = sizeof control[i];
+
+				cmsghdr* cmsg    = CMSG_FIRSTHDR(&mh);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type  = SO_TIMESTAMPING;
+				cmsg->cmsg_len   = CMSG_LEN(sizeof(uint32_t));
+				const uint32_t tsflags = SOF_TIMESTAMPING_TX_SOFTWARE;
+				memcpy(CMSG_DATA(cmsg), &tsflags, sizeof tsflags);
+			}
+		}
+
+		// A failed request cancels the rest of the chain. The chain is submitted again from the datagram after it.
+		for (size_t from = 0; from < n;)
+		{
+			for (size_t i = from; i < n; ++i)
+			{
+				io_uring_sqe* sqe = m_tx.get_sqe();
+				sqe->opcode    = IORING_OP_SENDMSG;
+				sqe->fd        = m_sock;
+				sqe->addr      = reinterpret_cast<uint64_t>(&msgs[i]);
+				sqe->len       = 1;
+				sqe->user_data = i;
+				// Link the datagrams so they leave in order (TX timestamp keys follow this order).
+				if (i + 1 < n)
+					sqe->flags = IOSQE_IO_LINK;
+			}
+
+			m_tx.submit_and_wait((unsigned) (n - from));
+
+			size_t failed = n;
+			for (size_t reaped = from; reaped < n;)
+			{
+				const io_uring_cqe* cqe = m_tx.peek_cqe();
+				if (!cqe)
+				{
+					m_tx.submit_and_wait((unsigned) (n - reaped));
+					continue;
+				}
+
+				const size_t i = (size_t) cqe->user_data;
+				if (cqe->res >= 0)
+				{
+					errors.data()[first + i] = 0;
+					++sent;
+				}
+				else if (cqe->res != -ECANCELED)
+				{
+					errors.data()[first + i] = -cqe->res;
+					failed = std::min(failed, i);
+				}
+				m_tx.cqe_seen();
+				++reaped;
+			}
+
+			from = failed + 1;
+		}
+	}
+
+	return sent;
+}
+
+#endif // ENABLE_IO_URING
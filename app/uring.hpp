@@ -0,0 +1,141 @@
+#pragma once
+#include <mutex>
+#include <vector>
+
+#include "buf_view.hpp"
+#include "netinet_any.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ENABLE_IO_URING 1
+#endif
+#endif
+
+#if ENABLE_IO_URING
+#include <linux/io_uring.h>
+
+struct datagram_info;
+
+/// Minimal io_uring instance on top of the raw system calls (no liburing dependency).
+/// Not thread-safe: a ring is expected to be used by a single thread at a time.
+class uring
+{
+public:
+	/// @param entries    the number of submission queue entries
+	/// @param cq_entries the number of completion queue entries
+	///
+	/// @throws std::runtime_error if io_uring is not available.
+	uring(unsigned entries, unsigned cq_entries);
+	~uring();
+
+	uring(const uring&) = delete;
+	uring& operator=(const uring&) = delete;
+
+public:
+	int fd() const { return m_fd; }
+
+	/// @returns A cleared submission queue entry, or nullptr if the queue is full.
+	io_uring_sqe* get_sqe();
+
+	/// @returns A cleared submission queue entry. If the queue is full, the pending entries are submitted first.
+	/// @throws std::runtime_error if the queue is still full (the kernel takes no more entries).
+	io_uring_sqe* get_sqe_or_submit();
+
+	/// Submit pending entries and wait for at least @a min_complete completions.
+	/// @param timeout_ms -1 waits with no time limit.
+	/// @returns false on timeout.
+	bool submit_and_wait(unsigned min_complete, int timeout_ms = -1);
+
+	/// @returns The oldest completion, or nullptr if there is none. Does not enter the kernel.
+	const io_uring_cqe* peek_cqe() const;
+
+	/// Mark the completion returned by peek_cqe() as consumed.
+	void cqe_seen();
+
+	/// Allocate @a count buffers of @a buf_size bytes each and provide them to the kernel as buffer group @a bgid.
+	void provide_buffers(unsigned short bgid, unsigned count, size_t buf_size);
+
+	/// @returns The provided buffer @a bid.
+	uint8_t* buffer(unsigned bid) { return m_buf_storage.data() + bid * m_buf_size; }
+
+	/// Give the buffer @a bid back to the kernel.
+	/// The request is queued and goes to the kernel with the next submission.
+	void recycle_buffer(unsigned bid);
+
+private:
+	int      m_fd = -1;
+	unsigned m_to_submit = 0;
+
+	void*  m_sq_ptr = nullptr;
+	size_t m_sq_size = 0;
+	void*  m_cq_ptr = nullptr;
+	size_t m_cq_size = 0;
+	io_uring_sqe* m_sqes = nullptr;
+	size_t m_sqes_size = 0;
+
+	unsigned* m_sq_head = nullptr;
+	unsigned* m_sq_tail = nullptr;
+	unsigned  m_sq_mask = 0;
+	unsigned* m_sq_array = nullptr;
+	unsigned* m_cq_head = nullptr;
+	unsigned* m_cq_tail = nullptr;
+	unsigned  m_cq_mask = 0;
+	io_uring_cqe* m_cqes = nullptr;
+
+	unsigned short       m_bgid = 0;
+	size_t               m_buf_size = 0;
+	std::vector<uint8_t> m_buf_storage;
+};
+
+/// io_uring datagram I/O of a UDP socket.
+/// Receiving keeps a multishot recvmsg posted against a group of provided buffers,
+/// so a burst of datagrams is taken from the completion queue without system calls.
+/// Sending submits a batch of datagrams as linked SQEs in one system call.
+class udp_uring
+{
+public:
+	explicit udp_uring(int sock);
+
+public:
+	/// Receive up to buffers.size() datagrams. Must be called from one thread only.
+	/// @returns The number of datagrams received, 0 on timeout.
+	size_t recv(buf_view<const mut_bufv> buffers, buf_view<datagram_info> infos, int timeout_ms);
+
+	/// Send datagrams as linked SQEs. Thread-safe.
+	/// A datagram that fails does not stop the others: the rest of the chain is submitted again.
+	/// @param errors [out] per datagram: 0 if it was sent, otherwise the error it failed with.
+	/// @param tx_timestamps request kernel TX timestamps for the datagrams.
+	/// @returns The number of datagrams sent.
+	size_t send(buf_view<const sockaddr_any> dst_addrs, buf_view<const const_bufv> buffers, buf_view<int> errors,
+		bool tx_timestamps);
+
+	/// File descriptor that becomes readable when received datagrams are pending.
+	int rx_fd() const { return m_rx.fd(); }
+
+private:
+	void arm_recv();
+
+private:
+	static constexpr unsigned short rx_bgid = 1;
+	static constexpr uint64_t rx_user_data = 1;
+	static constexpr size_t rx_name_size = sizeof(sockaddr_in6);
+	static constexpr size_t rx_control_size = 128;
+
+	const int m_sock;
+
+	uring  m_rx;
+	msghdr m_rx_msg;         // template of the multishot recvmsg
+	bool   m_rx_armed = false;
+
+	std::mutex m_tx_mtx;     // protects m_tx
+	uring      m_tx;
+};
+
+#else
+
+// Placeholder, so that socket_udp can hold a pointer to it on any platform.
+class udp_uring
+{
+};
+
+#endif // ENABLE_IO_URING
@@ -13,7 +13,8 @@ inline ValueType avg_rma(ValueType old_value, ValueType new_value)
 template <std::size_t N, typename ValueType>
 inline ValueType avg_rma_w(ValueType old_value, ValueType new_value, std::size_t new_val_weight)
 {
-    return (old_value * (N - new_val_weight) + new_value * new_val_weight) / N;
+    // Signed values must not be promoted to std::size_t.
+    return (old_value * ValueType(N - new_val_weight) + new_value * ValueType(new_val_weight)) / ValueType(N);
 }
 
 inline long long count_microseconds(const std::chrono::steady_clock::duration &t)
@@ -68,31 +69,104 @@ int pow10()
 }
 }
 
+/// Prints the provided steady clock time in human readable manner into @a out
+/// (up to 40 characters, without a terminating zero).
+/// @returns The end of the written characters.
+inline char* format_time_stdy(char* out, const std::chrono::steady_clock::time_point& timestamp);
+
 /// Prints the provided steady clock time in human readable manner
 inline std::string format_time_stdy(const std::chrono::steady_clock::time_point& timestamp)
 {
-    using namespace std;
+    char buf[40];
+    return std::string(buf, format_time_stdy(buf, timestamp));
+}
+
+/// Write the decimal representation of @a value to @a out without a terminating zero.
+/// @a out must have room for 20 characters.
+/// @returns The end of the written characters.
+inline char* format_uint(char* out, uint64_t value)
+{
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    char  tmp[20];
+    char* p = tmp + sizeof tmp;
+    while (value >= 100)
+    {
+        const unsigned pair = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10)
+    {
+        const unsigned pair = static_cast<unsigned>(value) * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    else
+    {
+        *--p = static_cast<char>('0' + value);
+    }
+
+    const size_t len = tmp + sizeof tmp - p;
+    memcpy(out, p, len);
+    return out + len;
+}
+
+/// Signed version of format_uint(). @a out must have room for 20 characters.
+inline char* format_int(char* out, int64_t value)
+{
+    if (value >= 0)
+        return format_uint(out, static_cast<uint64_t>(value));
+
+    *out = '-';
+    return format_uint(out + 1, 0 - static_cast<uint64_t>(value));
+}
+
+/// Write @a value with leading zeros to exactly @a width characters.
+inline char* format_uint_fixed(char* out, uint64_t value, int width)
+{
+    for (int i = width - 1; i >= 0; --i)
+    {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    return out + width;
+}
+
+inline char* format_time_stdy(char* out, const std::chrono::steady_clock::time_point& timestamp)
+{
     if (timestamp == std::chrono::steady_clock::time_point())
     {
         // Use special string for 0
-        return "00:00:00.000000";
+        static const char zero[] = "00:00:00.000000";
+        memcpy(out, zero, sizeof zero - 1);
+        return out + sizeof zero - 1;
     }
 
     const int64_t ticks_per_sec = (std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num);
-    const int     decimals      = pow10<ticks_per_sec>();
+    static const int decimals   = pow10<ticks_per_sec>();
     const uint64_t total_sec = count_seconds(timestamp.time_since_epoch());
     const uint64_t days = total_sec / (60 * 60 * 24);
     const uint64_t hours = total_sec / (60 * 60) - days * 24;
     const uint64_t minutes = total_sec / 60 - (days * 24 * 60) - hours * 60;
     const uint64_t seconds = total_sec - (days * 24 * 60 * 60) - hours * 60 * 60 - minutes * 60;
-    ostringstream out;
     if (days)
-        out << days << "D ";
-    out << setfill('0') << setw(2) << hours << ":"
-        << setfill('0') << setw(2) << minutes << ":"
-        << setfill('0') << setw(2) << seconds << "."
-        << setfill('0') << setw(decimals) << (timestamp - seconds_from(total_sec)).time_since_epoch().count();
-    return out.str();
+    {
+        out = format_uint(out, days);
+        *out++ = 'D';
+        *out++ = ' ';
+    }
+    out = format_uint_fixed(out, hours, 2);
+    *out++ = ':';
+    out = format_uint_fixed(out, minutes, 2);
+    *out++ = ':';
+    out = format_uint_fixed(out, seconds, 2);
+    *out++ = '.';
+    return format_uint_fixed(out, (timestamp - seconds_from(total_sec)).time_since_epoch().count(), decimals);
 }
 
 inline struct tm sys_local_time(time_t tt)
@@ -135,12 +209,11 @@ inline std::string format_time_sys(const std::chrono::steady_clock::time_point&
 
 #ifdef HAS_PUT_TIME
 // Follows ISO 8601
-inline std::string print_timestamp()
+inline std::string print_timestamp(const std::chrono::system_clock::time_point& systime_now = std::chrono::system_clock::now())
 {
     using namespace std;
     using namespace std::chrono;
 
-    const auto   systime_now = system_clock::now();
     const time_t time_now    = system_clock::to_time_t(systime_now);
 
     std::ostringstream output;
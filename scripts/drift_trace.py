@@ -0,0 +1,58 @@
+"""Loading of drift tracer trace files: CSV or binary (--trace-format binary)."""
+import numpy as np
+import pandas as pd
+
+
+MAGIC = b'DRFTRACE'
+FOOTER_MAGIC = b'DRFTINDX'
+FOOTER_SIZE = 32
+COLUMN_SIZE = 48
+COLUMN_TYPES = {1: '<i4', 2: '<u4', 3: '<i8'}
+
+
+def _read_header(mm):
+    if bytes(mm[0:8]) != MAGIC:
+        return None
+    record_size, header_size = np.frombuffer(mm, '<u2', 1, 10)[0], np.frombuffer(mm, '<u4', 1, 12)[0]
+    column_count, config_size = np.frombuffer(mm, '<u2', 1, 24)[0], np.frombuffer(mm, '<u4', 1, 28)[0]
+
+    names, formats, offsets = [], [], []
+    for i in range(column_count):
+        col = 32 + i * COLUMN_SIZE
+        names.append(bytes(mm[col:col + 32]).split(b'\0')[0].decode())
+        formats.append(COLUMN_TYPES[int(mm[col + 32])])
+        offsets.append(int(np.frombuffer(mm, '<u2', 1, col + 34)[0]))
+    dtype = np.dtype({'names': names, 'formats': formats, 'offsets': offsets, 'itemsize': int(record_size)})
+
+    config_start = 32 + column_count * COLUMN_SIZE
+    config = bytes(mm[config_start:config_start + config_size]).decode()
+    return dtype, int(header_size), config
+
+
+def load_trace(filepath, us_from=None, us_to=None):
+    """Load a trace file into a DataFrame.
+
+    A binary trace is memory-mapped, and only the records with usTimepointSys
+    in [us_from, us_to) are copied (the records are sorted by this column).
+    """
+    with open(filepath, 'rb') as f:
+        is_binary = f.read(len(MAGIC)) == MAGIC
+    if not is_binary:
+        return pd.read_csv(filepath)
+
+    mm = np.memmap(filepath, dtype=np.uint8, mode='r')
+    dtype, header_size, config = _read_header(mm)
+
+    record_count = (len(mm) - header_size) // dtype.itemsize
+    footer = mm[len(mm) - FOOTER_SIZE:]
+    if len(mm) >= header_size + FOOTER_SIZE and bytes(footer[0:8]) == FOOTER_MAGIC:
+        record_count = int(np.frombuffer(footer, '<u8', 1, 24)[0])
+
+    records = np.ndarray((record_count,), dtype, mm, header_size)
+    times = records['usTimepointSys']
+    first = np.searchsorted(times, us_from) if us_from is not None else 0
+    last = np.searchsorted(times, us_to) if us_to is not None else record_count
+
+    df = pd.DataFrame(records[first:last])
+    df.attrs['config'] = config
+    return df
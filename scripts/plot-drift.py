@@ -6,6 +6,8 @@ import plotly.graph_objects as go
 
 import click
 
+from drift_trace import load_trace
+
 pio.templates.default = "plotly_white"
 
 @click.command()
@@ -15,7 +17,7 @@ pio.templates.default = "plotly_white"
 )
 def main(filepath):
     
-    df_driftlog  = pd.read_csv(filepath)
+    df_driftlog  = load_trace(filepath)
     df_driftlog['usDriftSampleStdActual'] = df_driftlog['usDriftSampleStd'] + df_driftlog['usOverdriftStd'].cumsum()
     df_driftlog['usDriftStdActual']       = df_driftlog['usDriftStd'] + df_driftlog['usOverdriftStd'].cumsum()
     df_driftlog['sTime'] = df_driftlog['usElapsedStd'] / 1000000
@@ -0,0 +1,119 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+/// RTT of a drift sample: the sample itself and the smoothed RTT and RTT variance before it.
+struct rtt_sample
+{
+	int rtt_us     = 0;
+	int srtt_us    = 0; // 0 - not known yet
+	int rtt_var_us = 0;
+};
+
+enum class drift_filter
+{
+	off,
+	min_rtt,  // forward the sample with the lowest RTT of every min_rtt_window samples (as the NTP clock filter)
+	rtt_gate, // reject the samples above SRTT + 4 * RTTVar, weight the rest inversely to the RTT deviation
+};
+
+/// @param name off, min-rtt or rtt-gate (as in the command line options)
+inline drift_filter parse_drift_filter(const std::string& name)
+{
+	return name == "min-rtt" ? drift_filter::min_rtt
+		: name == "rtt-gate" ? drift_filter::rtt_gate : drift_filter::off;
+}
+
+/// Selects the drift samples passed to the drift tracer. A sample taken while the path queues
+/// is biased by the queueing delay of the ACKACK.
+class drift_sample_filter
+{
+public:
+	explicit drift_sample_filter(drift_filter mode = drift_filter::off)
+		: m_mode(mode)
+	{
+	}
+
+	/// @param [in,out] drift_us the drift sample, replaced with the sample to forward
+	/// @returns true if @a drift_us should be passed to the drift tracer.
+	bool filter(int64_t& drift_us, const rtt_sample& rtt)
+	{
+		// No RTT (the ACK record of the ACKACK was not found): it would win any min-rtt window.
+		if (rtt.rtt_us < 0)
+		{
+			++m_rejected;
+			return false;
+		}
+
+		switch (m_mode)
+		{
+		case drift_filter::min_rtt:
+			if (m_window_count == 0 || rtt.rtt_us < m_best_rtt_us)
+			{
+				m_best_rtt_us   = rtt.rtt_us;
+				m_best_drift_us = drift_us;
+			}
+			if (++m_window_count < min_rtt_window)
+			{
+				++m_rejected;
+				return false;
+			}
+			m_window_count = 0;
+			drift_us       = m_best_drift_us;
+			break;
+
+		case drift_filter::rtt_gate:
+		{
+			const int deviation = std::abs(rtt.rtt_us - rtt.srtt_us);
+			if (rtt.srtt_us != 0 && rtt.rtt_us > rtt.srtt_us + 4 * rtt.rtt_var_us)
+			{
+				++m_rejected;
+				return false;
+			}
+
+			// The weight falls from max_weight at no deviation to 1 at 4 * RTTVar.
+			const int64_t weight = rtt.srtt_us == 0 ? max_weight
+				: std::max<int64_t>(1, max_weight - max_weight * deviation / (4 * std::max(rtt.rtt_var_us, 1)));
+			m_weighted_drift_us = m_forwarded == 0 ? drift_us
+				: (m_weighted_drift_us * (max_weight - weight) + drift_us * weight) / max_weight;
+			drift_us = m_weighted_drift_us;
+			break;
+		}
+
+		case drift_filter::off:
+			break;
+		}
+
+		++m_forwarded;
+		return true;
+	}
+
+	/// The time base has been shifted by @a overdrift_us: the following samples are smaller by it.
+	void on_shift(int64_t overdrift_us) { m_weighted_drift_us -= overdrift_us; }
+
+	drift_filter mode() const { return m_mode; }
+
+	/// The number of samples passed to the drift tracer.
+	uint64_t forwarded() const { return m_forwarded; }
+
+	/// The number of samples held back.
+	uint64_t rejected() const { return m_rejected; }
+
+private:
+	static constexpr int     min_rtt_window = 8;
+	static constexpr int64_t max_weight     = 8;
+
+	const drift_filter m_mode;
+	uint64_t m_forwarded = 0;
+	uint64_t m_rejected  = 0;
+
+	// min_rtt
+	int     m_window_count  = 0;
+	int     m_best_rtt_us   = 0;
+	int64_t m_best_drift_us = 0;
+
+	// rtt_gate
+	int64_t m_weighted_drift_us = 0;
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+/// Drift tracer modelling the peer's clock with a Kalman filter: the state is the drift (offset, us)
+/// and the skew (us per second, i.e. ppm), the drift samples are noisy measurements of the offset.
+///
+/// The measurement noise of a sample is the RTT variance at the time, so samples taken while
+/// the queues are unsteady count less. The estimate follows the skew instead of lagging behind it,
+/// and is usable after a few seconds instead of after a full block of samples.
+/// The time base is shifted by MAX_DRIFT once the offset exceeds MAX_DRIFT and its standard deviation
+/// is below a quarter of MAX_DRIFT. update() returns true only then, and the overdrift is cleared
+/// with the next sample.
+template<int MAX_DRIFT>
+class KalmanDriftTracer
+{
+	// The offset is kept relative to the initial time base, so the state stays valid after the time base is shifted.
+	double   m_offset = 0; // us
+	double   m_skew = 0;   // us/s
+	double   m_p00 = 0, m_p01 = 0, m_p11 = 0; // covariance of (offset, skew)
+	int64_t  m_qShifts = 0;
+	int64_t  m_last_us = 0;
+	uint64_t m_samples = 0;
+
+	int64_t m_qDrift = 0;
+	int64_t m_qOverdrift = 0;
+
+	// Process noise: random walk of the offset (us^2/s) and of the skew ((us/s)^2/s).
+	static constexpr double offset_noise = 1.0;
+	static constexpr double skew_noise   = 1e-4;
+	// Measurement noise floor (us), e.g. timer and scheduling jitter.
+	static constexpr double min_sample_noise = 10.0;
+	// Uncertainty of the skew before the first sample (us/s).
+	static constexpr double initial_skew_std = 100.0;
+
+public:
+	/// @param driftval drift sample against the current time base
+	/// @param t_us time of the sample (local steady clock)
+	/// @param rtt_var_us RTT variance at the time of the sample
+	bool update(int64_t driftval, int64_t t_us, int rtt_var_us)
+	{
+		m_qOverdrift = 0;
+		const double z     = double(driftval + m_qShifts);
+		const double noise = std::max(double(rtt_var_us), min_sample_noise);
+		const double r     = noise * noise;
+
+		if (m_samples++ == 0)
+		{
+			m_offset = z;
+			m_p00    = r;
+			m_p11    = initial_skew_std * initial_skew_std;
+		}
+		else
+		{
+			// Predict: offset += skew * dt.
+			const double dt = std::max<int64_t>(t_us - m_last_us, 0) / 1000000.0;
+			m_offset += m_skew * dt;
+			m_p00 += dt * (2 * m_p01 + dt * m_p11) + offset_noise * dt + skew_noise * dt * dt * dt / 3;
+			m_p01 += dt * m_p11 + skew_noise * dt * dt / 2;
+			m_p11 += skew_noise * dt;
+
+			// Correct with the sample.
+			const double s  = m_p00 + r;
+			const double k0 = m_p00 / s;
+			const double k1 = m_p01 / s;
+			const double y  = z - m_offset;
+			m_offset += k0 * y;
+			m_skew += k1 * y;
+			m_p11 -= k1 * m_p01;
+			m_p01 -= k0 * m_p01;
+			m_p00 -= k0 * m_p00;
+		}
+		m_last_us = t_us;
+
+		m_qDrift = std::llround(m_offset) - m_qShifts;
+		if (std::abs(m_qDrift) <= MAX_DRIFT || 16 * m_p00 > double(MAX_DRIFT) * MAX_DRIFT)
+			return false;
+
+		m_qOverdrift = m_qDrift < 0 ? -MAX_DRIFT : MAX_DRIFT;
+		m_qDrift -= m_qOverdrift;
+		m_qShifts += m_qOverdrift;
+		return true;
+	}
+
+	int64_t drift() const { return m_qDrift; }
+	int64_t overdrift() const { return m_qOverdrift; }
+
+	/// The estimated skew of the peer's clock, ppm.
+	double skew_ppm() const { return m_skew; }
+
+	/// Variance of the drift estimate, us^2.
+	double drift_variance() const { return m_p00; }
+
+	/// Variance of the skew estimate, ppm^2.
+	double skew_variance() const { return m_p11; }
+
+	/// Covariance of the drift and the skew estimates, us * ppm.
+	double drift_skew_covariance() const { return m_p01; }
+};
@@ -0,0 +1,162 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+namespace
+{
+
+void* open_file(const string& filename, bool write, DWORD disposition)
+{
+	void* file = CreateFileA(filename.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw runtime_error("Failed to open " + filename + "!!!");
+	return file;
+}
+
+} // namespace
+
+mapped_file::mapped_file(const string& filename)
+{
+	m_file = open_file(filename, false, OPEN_EXISTING);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = static_cast<size_t>(size.QuadPart);
+	if (m_size == 0)
+		return;
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping)
+		m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		unmap();
+		throw runtime_error("Failed to map " + filename);
+	}
+}
+
+mapped_file::mapped_file(const string& filename, size_t size, bool keep)
+	: m_size(size)
+{
+	m_file = open_file(filename, true, keep ? OPEN_ALWAYS : CREATE_ALWAYS);
+
+	// The mapping extends the file, allocating its clusters (the file is not sparse).
+	const uint64_t size64 = size;
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+		static_cast<DWORD>(size64), nullptr);
+	if (m_mapping)
+		m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0));
+	if (!m_data)
+	{
+		unmap();
+		throw runtime_error("Failed to map " + filename);
+	}
+}
+
+void mapped_file::sync_async()
+{
+	if (m_data)
+		FlushViewOfFile(m_data, 0);
+}
+
+void mapped_file::unmap()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+	m_data    = nullptr;
+	m_mapping = nullptr;
+	m_file    = nullptr;
+}
+
+#else
+
+mapped_file::mapped_file(const string& filename)
+{
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw runtime_error("Failed to open " + filename + "!!!");
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		m_size     = static_cast<size_t>(st.st_size);
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			throw runtime_error("Failed to map " + filename + ", error " + to_string(errno));
+		}
+		m_data = static_cast<uint8_t*>(data);
+	}
+	::close(fd);
+}
+
+mapped_file::mapped_file(const string& filename, size_t size, bool keep)
+	: m_size(size)
+{
+	const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+	if (fd == -1)
+		throw runtime_error("Failed to open " + filename + "!!!");
+
+	if (ftruncate(fd, static_cast<off_t>(size)) == -1)
+	{
+		const int err = errno;
+		::close(fd);
+		throw runtime_error("Failed to resize " + filename + ", error " + to_string(err));
+	}
+
+	// A sparse file gets its blocks on the first write to a page. On a full disk that write is a SIGBUS.
+	const int alloc_err = posix_fallocate(fd, 0, static_cast<off_t>(size));
+	if (alloc_err != 0)
+	{
+		::close(fd);
+		throw runtime_error("Failed to reserve " + to_string(size) + " bytes for " + filename + ", error " +
+			to_string(alloc_err));
+	}
+
+	void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	const int err = errno;
+	::close(fd);
+	if (data == MAP_FAILED)
+		throw runtime_error("Failed to map " + filename + ", error " + to_string(err));
+	m_data = static_cast<uint8_t*>(data);
+}
+
+void mapped_file::sync_async()
+{
+	if (m_data)
+		msync(m_data, m_size, MS_ASYNC);
+}
+
+void mapped_file::unmap()
+{
+	if (m_data)
+		munmap(m_data, m_size);
+	m_data = nullptr;
+}
+
+#endif
+
+mapped_file::~mapped_file()
+{
+	unmap();
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// A file mapped into memory.
+class mapped_file
+{
+public:
+	/// Map an existing file read-only. An empty file is not mapped (data() is nullptr).
+	/// @throws std::runtime_error if the file can't be opened or mapped.
+	explicit mapped_file(const std::string& filename);
+
+	/// Create a file of @a size bytes and map it for writing. The disk blocks are reserved up front,
+	/// so writing to the mapping can't fail later on a full disk (SIGBUS).
+	/// @param keep keep the content of an existing file (resized to @a size) instead of truncating it
+	/// @throws std::runtime_error if the file can't be created, reserved or mapped.
+	mapped_file(const std::string& filename, size_t size, bool keep = false);
+
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+public:
+	const uint8_t* data() const { return m_data; }
+	uint8_t*       data() { return m_data; }
+	size_t         size() const { return m_size; }
+
+	/// Schedule writing the modified pages to the file (does not wait).
+	void sync_async();
+
+private:
+	void unmap();
+
+private:
+	uint8_t* m_data = nullptr;
+	size_t   m_size = 0;
+#ifdef _WIN32
+	void* m_file    = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+/// Continuous estimate of the clock offset and skew (frequency offset) of a peer.
+///
+/// The drift samples are fitted with a line drift = offset + skew * t by least squares,
+/// weighting the samples exponentially by their age with the time constant WINDOW_S seconds.
+/// Each update takes O(1): the weighted sums are kept relative to the time of the last sample,
+/// so they stay small however long the estimator runs.
+template <unsigned WINDOW_S = 60>
+class lsq_skew_estimator
+{
+public:
+	/// @param t_us time of the sample (local steady clock)
+	/// @param drift_us drift sample, measured against a fixed time base
+	void update(int64_t t_us, int64_t drift_us)
+	{
+		if (m_sw == 0)
+		{
+			m_drift_ref_us = drift_us;
+		}
+		else
+		{
+			// Move the origin to the new sample and age the previous ones.
+			const double dt    = (t_us - m_last_us) / 1000000.0;
+			const double decay = std::exp(-dt / WINDOW_S);
+			m_sxx = (m_sxx - 2 * dt * m_sx + dt * dt * m_sw) * decay;
+			m_sxy = (m_sxy - dt * m_sy) * decay;
+			m_sx  = (m_sx - dt * m_sw) * decay;
+			m_sy *= decay;
+			m_sw *= decay;
+		}
+
+		m_last_us = t_us;
+		m_sw += 1;
+		m_sy += double(drift_us - m_drift_ref_us);
+
+		// The slope is undefined until the samples span some time.
+		const double det = m_sw * m_sxx - m_sx * m_sx;
+		if (det > 1e-9 * m_sw * m_sw)
+			m_skew = (m_sw * m_sxy - m_sx * m_sy) / det;
+	}
+
+	/// The drift at the time of the last sample on the fitted line, us.
+	int64_t offset_us() const
+	{
+		return m_sw == 0 ? 0 : m_drift_ref_us + std::llround((m_sy - m_skew * m_sx) / m_sw);
+	}
+
+	/// The skew of the remote clock relative to the local one, ppm (us per second).
+	double skew_ppm() const { return m_skew; }
+
+private:
+	// Weighted sums of 1, x, y, x^2, x*y, where x is the time (s) relative to the last sample
+	// and y is the drift (us) relative to the first sample.
+	double  m_sw  = 0;
+	double  m_sx  = 0;
+	double  m_sy  = 0;
+	double  m_sxx = 0;
+	double  m_sxy = 0;
+	double  m_skew = 0;
+	int64_t m_last_us      = 0;
+	int64_t m_drift_ref_us = 0;
+};
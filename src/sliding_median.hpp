@@ -0,0 +1,154 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/// Median of the last N values, updated in O(log N) per value.
+///
+/// @details
+/// The window is split into two heaps: a max-heap of the lower half and a min-heap of the upper half,
+/// so the median is at their tops. The heaps hold the slots of a ring of the values, and each slot
+/// knows its position in its heap. The newest value overwrites the oldest one in place and is sifted
+/// to its position, so an update never allocates memory.
+///
+/// @tparam T signed integer type
+/// @tparam N window size
+template <typename T, size_t N>
+class sliding_median
+{
+	static_assert(N > 0, "N must be positive");
+
+public:
+	/// Add a value, replacing the oldest one if the window is full.
+	void push(T value)
+	{
+		const size_t slot = m_next;
+		m_next            = m_next + 1 == N ? 0 : m_next + 1;
+		m_values[slot]    = value;
+
+		if (m_count < N)
+		{
+			++m_count;
+			m_in_low[slot]      = true;
+			m_pos[slot]         = m_low_size;
+			m_low[m_low_size++] = slot;
+			sift_up(m_low, slot, true);
+			swap_tops();
+
+			// Keep the lower half the same size or one larger.
+			if (m_low_size > m_high_size + 1)
+			{
+				const size_t top = m_low[0];
+				remove_top(m_low, m_low_size, true);
+				m_in_low[top]         = false;
+				m_pos[top]            = m_high_size;
+				m_high[m_high_size++] = top;
+				sift_up(m_high, top, false);
+			}
+			return;
+		}
+
+		// The slot keeps its heap, so the sizes do not change.
+		if (m_in_low[slot])
+		{
+			sift_up(m_low, slot, true);
+			sift_down(m_low, m_low_size, slot, true);
+		}
+		else
+		{
+			sift_up(m_high, slot, false);
+			sift_down(m_high, m_high_size, slot, false);
+		}
+		swap_tops();
+	}
+
+	/// The median of the window (the mean of the two middle values if the size is even).
+	/// 0 if the window is empty.
+	T median() const
+	{
+		if (m_count == 0)
+			return 0;
+
+		const T lo = m_values[m_low[0]];
+		if (m_low_size > m_high_size)
+			return lo;
+		const T hi = m_values[m_high[0]];
+		return lo + (hi - lo) / 2;
+	}
+
+	size_t size() const { return m_count; }
+	static constexpr size_t capacity() { return N; }
+
+private:
+	// A parent is not less (low) or not greater (high) than its children.
+	bool before(size_t a, size_t b, bool low) const
+	{
+		return low ? m_values[a] > m_values[b] : m_values[a] < m_values[b];
+	}
+
+	void swap_at(size_t* heap, size_t i, size_t j)
+	{
+		std::swap(heap[i], heap[j]);
+		m_pos[heap[i]] = i;
+		m_pos[heap[j]] = j;
+	}
+
+	void sift_up(size_t* heap, size_t slot, bool low)
+	{
+		for (size_t i = m_pos[slot]; i > 0 && before(heap[i], heap[(i - 1) / 2], low); i = (i - 1) / 2)
+			swap_at(heap, i, (i - 1) / 2);
+	}
+
+	void sift_down(size_t* heap, size_t size, size_t slot, bool low)
+	{
+		for (size_t i = m_pos[slot];;)
+		{
+			size_t best = i;
+			for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < size; ++child)
+			{
+				if (before(heap[child], heap[best], low))
+					best = child;
+			}
+			if (best == i)
+				return;
+			swap_at(heap, i, best);
+			i = best;
+		}
+	}
+
+	void remove_top(size_t* heap, size_t& size, bool low)
+	{
+		swap_at(heap, 0, --size);
+		if (size)
+			sift_down(heap, size, heap[0], low);
+	}
+
+	/// Restore the order of the halves after one value has changed: the top of the lower half
+	/// may be greater than the top of the upper half, then they change places.
+	void swap_tops()
+	{
+		if (m_high_size == 0 || m_values[m_low[0]] <= m_values[m_high[0]])
+			return;
+
+		const size_t lo = m_low[0], hi = m_high[0];
+		m_low[0]     = hi;
+		m_high[0]    = lo;
+		m_in_low[hi] = true;
+		m_in_low[lo] = false;
+		m_pos[hi]    = 0;
+		m_pos[lo]    = 0;
+		sift_down(m_low, m_low_size, hi, true);
+		sift_down(m_high, m_high_size, lo, false);
+	}
+
+private:
+	T      m_values[N];       // ring of the window values
+	size_t m_pos[N];          // position of a slot in its heap
+	bool   m_in_low[N];       // the heap of a slot
+	size_t m_low[N / 2 + 1];  // max-heap of the lower half (slots)
+	size_t m_high[N / 2 + 1]; // min-heap of the upper half (slots)
+	size_t m_low_size  = 0;
+	size_t m_high_size = 0;
+	size_t m_count     = 0;
+	size_t m_next      = 0; // the slot of the next value
+};
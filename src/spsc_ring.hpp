@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+/// Bounded lock-free ring buffer for a single producer and a single consumer.
+///
+/// @details
+/// The producer and the consumer each own one index and only read the other one,
+/// so push() and pop() are a few loads and stores with no locks and no system calls.
+/// Each side also caches the last seen value of the other index to avoid touching
+/// the other side's cache line on every call.
+///
+/// @tparam T    trivially copyable element type
+/// @tparam SIZE capacity, must be a power of two
+template <typename T, size_t SIZE>
+class spsc_ring
+{
+	static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+	spsc_ring() = default;
+
+	spsc_ring(const spsc_ring&) = delete;
+	spsc_ring& operator=(const spsc_ring&) = delete;
+
+	static constexpr size_t capacity() { return SIZE; }
+
+	/// Append an element. Called by the producer only.
+	/// @returns false if the ring is full (the element is not added).
+	bool push(const T& value)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head_cache == SIZE)
+		{
+			m_head_cache = m_head.load(std::memory_order_acquire);
+			if (tail - m_head_cache == SIZE)
+				return false;
+		}
+
+		m_items[tail & (SIZE - 1)] = value;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// Take the oldest element. Called by the consumer only.
+	/// @returns false if the ring is empty.
+	bool pop(T& value)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail_cache)
+		{
+			m_tail_cache = m_tail.load(std::memory_order_acquire);
+			if (head == m_tail_cache)
+				return false;
+		}
+
+		value = m_items[head & (SIZE - 1)];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// The number of elements in the ring. Exact only when called by the producer or the consumer
+	/// while the other side is idle.
+	size_t size() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	bool empty() const { return size() == 0; }
+
+private:
+	static constexpr size_t cache_line = 64;
+
+	// Consumer side.
+	alignas(cache_line) std::atomic<size_t> m_head{0};
+	size_t m_tail_cache = 0;
+
+	// Producer side.
+	alignas(cache_line) std::atomic<size_t> m_tail{0};
+	size_t m_head_cache = 0;
+
+	alignas(cache_line) T m_items[SIZE];
+};
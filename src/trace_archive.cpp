@@ -0,0 +1,337 @@
+#include "trace_archive.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "varint.hpp"
+
+using namespace std;
+
+namespace
+{
+
+template <typename T>
+void store_le(uint8_t* dst, T value)
+{
+	for (size_t i = 0; i < sizeof(T); ++i)
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+template <typename T>
+T load_le(const uint8_t* src)
+{
+	T v = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		v |= static_cast<T>(src[i]) << (8 * i);
+	return v;
+}
+
+// Wrapping arithmetic: a difference of two values may not fit into int64_t.
+int64_t add(int64_t a, int64_t b)
+{
+	return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+int64_t sub(int64_t a, int64_t b)
+{
+	return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+template <typename T, T trace_row::*M>
+int64_t get_field(const trace_row& row)
+{
+	return static_cast<int64_t>(row.*M);
+}
+
+template <typename T, T trace_row::*M>
+void set_field(trace_row& row, int64_t value)
+{
+	row.*M = static_cast<T>(value);
+}
+
+enum class column_coding
+{
+	plain,          // the value itself, for the columns that jitter around a level
+	delta,          // difference to the previous row
+	delta_of_delta, // difference between consecutive deltas, for the columns growing at a steady pace
+};
+
+struct column_codec
+{
+	column_coding coding;
+	int           base; // the column is coded as the difference to this (preceding) column of the row, -1 - none
+	int64_t (*get)(const trace_row&);
+	void (*set)(trace_row&, int64_t);
+};
+
+#define ARCHIVE_COLUMN(type, field, coding, base) \
+	{column_coding::coding, base, &get_field<type, &trace_row::field>, &set_field<type, &trace_row::field>}
+
+// Columns of a block in the order they are stored.
+// Many columns are close to another one of the same row (e.g. system and steady clock times),
+// so the difference to that column is stored instead.
+const column_codec columns[] = {
+	ARCHIVE_COLUMN(int64_t, us_elapsed_std, delta_of_delta, -1),           // 0
+	ARCHIVE_COLUMN(int64_t, us_elapsed_sys, delta, 0),                     // 1
+	ARCHIVE_COLUMN(int64_t, us_elapsed_kernel_std, delta, 0),              // 2
+	ARCHIVE_COLUMN(int64_t, us_timepoint_sys, delta, 0),                   // 3
+	ARCHIVE_COLUMN(uint32_t, us_ackack_timestamp_std, delta_of_delta, -1), // 4
+	ARCHIVE_COLUMN(uint32_t, us_ackack_timestamp_sys, delta, 4),           // 5
+	ARCHIVE_COLUMN(int32_t, us_rtt_std, delta, -1),                        // 6
+	ARCHIVE_COLUMN(int32_t, us_rtt_sys, plain, 6),                         // 7
+	ARCHIVE_COLUMN(int32_t, us_smoothed_rtt_std, delta, -1),               // 8
+	ARCHIVE_COLUMN(int32_t, rtt_var_std, delta, -1),                       // 9
+	ARCHIVE_COLUMN(int64_t, us_drift_sample_std, plain, -1),               // 10
+	ARCHIVE_COLUMN(int64_t, us_drift_std, delta, -1),                      // 11
+	ARCHIVE_COLUMN(int64_t, us_overdrift_std, plain, -1),                  // 12
+	ARCHIVE_COLUMN(int64_t, ns_tsbpd_time_base_std, delta, -1),            // 13
+	ARCHIVE_COLUMN(int32_t, us_drift_est_std, delta, -1),                  // 14
+	ARCHIVE_COLUMN(int32_t, ppb_skew_est, delta, -1),                      // 15
+};
+
+#undef ARCHIVE_COLUMN
+
+constexpr size_t column_count      = sizeof(columns) / sizeof(columns[0]);
+constexpr size_t column_count_v1   = 14; // version 1 archives have no skew estimate columns
+constexpr size_t file_header_size  = 16;
+constexpr size_t block_header_size = 12;
+
+// A block can't be larger than the maximum varint size of all its values.
+constexpr size_t max_payload_size = trace_archive_block_rows * column_count * 10;
+
+} // namespace
+
+bool is_trace_archive(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	char     magic[sizeof trace_archive_magic];
+	return in.read(magic, sizeof magic) && memcmp(magic, trace_archive_magic, sizeof magic) == 0;
+}
+
+trace_archive_writer::trace_archive_writer(const string& filename, const string& config, bool append)
+{
+	m_rows.reserve(trace_archive_block_rows);
+
+	error_code ec;
+	const auto existing_size = filesystem::file_size(filename, ec);
+	if (append && !ec && existing_size > 0)
+	{
+		reopen(filename);
+		m_out.open(filename, ios::binary | ios::app);
+		if (!m_out)
+			throw runtime_error("Failed to open " + filename + "!!!");
+		return;
+	}
+
+	m_out.open(filename, ios::binary | ios::trunc);
+	if (!m_out)
+		throw runtime_error("Failed to open " + filename + "!!!");
+
+	uint8_t header[file_header_size];
+	memcpy(header, trace_archive_magic, sizeof trace_archive_magic);
+	store_le<uint16_t>(header + 8, trace_archive_version);
+	store_le<uint16_t>(header + 10, column_count);
+	store_le<uint32_t>(header + 12, static_cast<uint32_t>(config.size()));
+	m_out.write(reinterpret_cast<const char*>(header), sizeof header);
+	m_out.write(config.data(), config.size());
+}
+
+trace_archive_writer::~trace_archive_writer()
+{
+	close();
+}
+
+void trace_archive_writer::reopen(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	uint8_t  header[file_header_size];
+	if (!in.read(reinterpret_cast<char*>(header), sizeof header) ||
+		memcmp(header, trace_archive_magic, sizeof trace_archive_magic) != 0 ||
+		load_le<uint16_t>(header + 8) != trace_archive_version)
+		throw runtime_error(filename + " is not a compatible trace archive");
+
+	// Skip the complete blocks, an incomplete one is cut off.
+	const uint64_t file_size = filesystem::file_size(filename);
+	uint64_t       end       = file_header_size + load_le<uint32_t>(header + 12);
+	uint8_t        block_header[block_header_size];
+	while (end + block_header_size <= file_size && in.seekg(end) &&
+		   in.read(reinterpret_cast<char*>(block_header), sizeof block_header))
+	{
+		const uint64_t block_end = end + block_header_size + load_le<uint32_t>(block_header + 4);
+		if (block_end > file_size)
+			break;
+		end = block_end;
+	}
+	in.close();
+
+	if (end < file_size)
+		filesystem::resize_file(filename, end);
+}
+
+void trace_archive_writer::write(const trace_row& row)
+{
+	m_rows.push_back(row);
+	if (m_rows.size() == trace_archive_block_rows)
+		write_block();
+}
+
+void trace_archive_writer::flush()
+{
+	write_block();
+	m_out.flush();
+}
+
+void trace_archive_writer::close()
+{
+	if (!m_out.is_open())
+		return;
+
+	write_block();
+	m_out.close();
+}
+
+void trace_archive_writer::write_block()
+{
+	if (m_rows.empty())
+		return;
+
+	m_payload.clear();
+	for (const column_codec& col : columns)
+	{
+		int64_t  prev = 0, prev_delta = 0;
+		uint64_t zeros = 0; // the length of the current run of zeros
+		for (size_t i = 0; i < m_rows.size(); ++i)
+		{
+			const trace_row& row   = m_rows[i];
+			const int64_t    value = col.base < 0 ? col.get(row) : sub(col.get(row), columns[col.base].get(row));
+			const int64_t    delta = sub(value, prev);
+			const int64_t    coded = col.coding == column_coding::plain ? value
+								   : col.coding == column_coding::delta ? delta
+								   : sub(delta, prev_delta);
+			prev       = value;
+			prev_delta = i == 0 ? 0 : delta; // the first value of a block is stored as is
+
+			// A run of zeros is stored as a zero followed by the number of more zeros.
+			if (coded == 0)
+			{
+				++zeros;
+				continue;
+			}
+			if (zeros)
+			{
+				varint_append(m_payload, 0);
+				varint_append(m_payload, zeros - 1);
+				zeros = 0;
+			}
+			varint_append(m_payload, zigzag_encode(coded));
+		}
+
+		if (zeros)
+		{
+			varint_append(m_payload, 0);
+			varint_append(m_payload, zeros - 1);
+		}
+	}
+
+	uint8_t header[block_header_size];
+	store_le<uint32_t>(header, static_cast<uint32_t>(m_rows.size()));
+	store_le<uint32_t>(header + 4, static_cast<uint32_t>(m_payload.size()));
+	store_le<uint32_t>(header + 8, crc32(m_payload.data(), m_payload.size()));
+	m_out.write(reinterpret_cast<const char*>(header), sizeof header);
+	m_out.write(reinterpret_cast<const char*>(m_payload.data()), m_payload.size());
+	m_rows.clear();
+}
+
+trace_archive_reader::trace_archive_reader(const string& filename)
+	: m_in(filename, ios::binary)
+	, m_filename(filename)
+{
+	if (!m_in)
+		throw runtime_error("Failed to open " + filename + "!!!");
+
+	uint8_t header[file_header_size];
+	if (!m_in.read(reinterpret_cast<char*>(header), sizeof header) ||
+		memcmp(header, trace_archive_magic, sizeof trace_archive_magic) != 0)
+		throw runtime_error(filename + " is not a trace archive");
+	const uint16_t version = load_le<uint16_t>(header + 8);
+	m_column_count         = load_le<uint16_t>(header + 10);
+	if (!(version == trace_archive_version && m_column_count == column_count) &&
+		!(version == 1 && m_column_count == column_count_v1))
+		throw runtime_error(filename + ": unsupported trace archive version");
+
+	m_config.resize(load_le<uint32_t>(header + 12));
+	if (!m_in.read(&m_config[0], m_config.size()))
+		throw runtime_error(filename + ": truncated trace archive header");
+}
+
+bool trace_archive_reader::next(trace_row& row)
+{
+	if (m_pos == m_rows.size() && !read_block())
+		return false;
+
+	row = m_rows[m_pos++];
+	return true;
+}
+
+bool trace_archive_reader::read_block()
+{
+	uint8_t header[block_header_size];
+	if (!m_in.read(reinterpret_cast<char*>(header), sizeof header))
+	{
+		if (m_in.gcount() == 0)
+			return false;
+		throw runtime_error(m_filename + ": truncated block");
+	}
+
+	const uint32_t row_count    = load_le<uint32_t>(header);
+	const uint32_t payload_size = load_le<uint32_t>(header + 4);
+	if (row_count == 0 || row_count > trace_archive_block_rows || payload_size > max_payload_size)
+		throw runtime_error(m_filename + ": corrupted block header");
+
+	m_payload.resize(payload_size);
+	if (!m_in.read(reinterpret_cast<char*>(m_payload.data()), payload_size))
+		throw runtime_error(m_filename + ": truncated block");
+	if (crc32(m_payload.data(), m_payload.size()) != load_le<uint32_t>(header + 8))
+		throw runtime_error(m_filename + ": block checksum mismatch");
+
+	m_rows.assign(row_count, trace_row());
+	m_pos = 0;
+
+	const uint8_t* pos = m_payload.data();
+	const uint8_t* end = pos + m_payload.size();
+	// The columns an older archive does not have are left zero.
+	for (size_t c = 0; c < m_column_count; ++c)
+	{
+		const column_codec& col  = columns[c];
+		int64_t             prev = 0, prev_delta = 0;
+		uint64_t            zeros = 0; // more zeros left in the current run
+		for (uint32_t i = 0; i < row_count; ++i)
+		{
+			uint64_t coded = 0;
+			if (zeros)
+			{
+				--zeros;
+			}
+			else
+			{
+				if (!varint_read(pos, end, coded))
+					throw runtime_error(m_filename + ": corrupted block");
+				if (coded == 0 && !varint_read(pos, end, zeros))
+					throw runtime_error(m_filename + ": corrupted block");
+			}
+
+			trace_row&    row   = m_rows[i];
+			const int64_t value = col.coding == column_coding::plain ? zigzag_decode(coded)
+								: col.coding == column_coding::delta ? add(prev, zigzag_decode(coded))
+								: add(prev, add(prev_delta, zigzag_decode(coded)));
+			col.set(row, col.base < 0 ? value : add(value, columns[col.base].get(row)));
+			prev_delta = i == 0 ? 0 : sub(value, prev);
+			prev       = value;
+		}
+
+		if (zeros)
+			throw runtime_error(m_filename + ": corrupted block");
+	}
+	return true;
+}
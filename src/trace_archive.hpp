@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "trace_file.hpp"
+
+/// Compressed columnar drift trace archive.
+///
+/// @details
+/// All values are little-endian.
+///
+/// @code
+/// file:   magic "DRFTARCH" | version (u16) | column count (u16) | config size (u32) | config text | block...
+/// block:  row count (u32) | payload size (u32) | CRC-32 of the payload (u32) | payload
+/// payload: column 0 of all rows | column 1 of all rows | ...
+/// @endcode
+///
+/// A column is stored as zig-zag varints of the differences between consecutive values
+/// (delta), or of the differences between consecutive deltas (delta-of-delta) for the columns
+/// that grow at a steady pace (times). Runs of zeros (a value that does not change) are run-length coded.
+/// A column close to another one of the same row
+/// (e.g. the system and the steady clock times) is coded as the difference to that column.
+/// Each block starts from zero, so it can be decoded on its own.
+/// The order and the coding of the columns are defined in trace_archive.cpp.
+
+constexpr char     trace_archive_magic[8]   = {'D', 'R', 'F', 'T', 'A', 'R', 'C', 'H'};
+constexpr uint16_t trace_archive_version    = 2;
+constexpr size_t   trace_archive_block_rows = 4096;
+
+/// Writes a compressed trace archive. Rows are buffered and written as a block
+/// of trace_archive_block_rows rows, or fewer on flush() and close().
+class trace_archive_writer
+{
+public:
+	/// @param config text describing the tracing configuration, stored in the header
+	/// @param append continue an existing archive (if it is not empty) instead of overwriting it
+	///
+	/// @throws std::runtime_error if the file can't be opened or the existing file is not an archive.
+	trace_archive_writer(const std::string& filename, const std::string& config, bool append = false);
+
+	/// Writes the buffered rows and closes the file.
+	~trace_archive_writer();
+
+	trace_archive_writer(const trace_archive_writer&) = delete;
+	trace_archive_writer& operator=(const trace_archive_writer&) = delete;
+
+public:
+	void write(const trace_row& row);
+
+	/// Write the buffered rows as a (short) block.
+	void flush();
+
+	void close();
+
+private:
+	void write_block();
+
+	/// Check the header of an existing archive and cut off an incomplete block at the end.
+	void reopen(const std::string& filename);
+
+private:
+	std::ofstream          m_out;
+	std::vector<trace_row> m_rows;
+	std::vector<uint8_t>   m_payload;
+};
+
+/// Streaming decoder of a trace archive: holds one block in memory at a time.
+class trace_archive_reader
+{
+public:
+	/// @throws std::runtime_error if the file can't be opened or is not an archive.
+	explicit trace_archive_reader(const std::string& filename);
+
+public:
+	const std::string& config() const { return m_config; }
+
+	/// Read the next row.
+	/// @returns false at the end of the archive.
+	/// @throws std::runtime_error if a block is corrupted (checksum mismatch) or truncated.
+	bool next(trace_row& row);
+
+private:
+	bool read_block();
+
+private:
+	std::ifstream          m_in;
+	std::string            m_filename;
+	std::string            m_config;
+	std::vector<trace_row> m_rows;
+	size_t                 m_pos = 0;
+	size_t                 m_column_count = 0; // stored in the file
+	std::vector<uint8_t>   m_payload;
+};
+
+/// @returns true if the file starts with the archive magic.
+bool is_trace_archive(const std::string& filename);
@@ -0,0 +1,394 @@
+#include "trace_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+
+using namespace std;
+
+namespace
+{
+
+template <typename T>
+void store_le(uint8_t* dst, T value)
+{
+	using U = typename std::make_unsigned<T>::type;
+	U v     = static_cast<U>(value);
+	for (size_t i = 0; i < sizeof(T); ++i)
+		dst[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+template <typename T>
+T load_le(const uint8_t* src)
+{
+	using U = typename std::make_unsigned<T>::type;
+	U v     = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		v |= static_cast<U>(src[i]) << (8 * i);
+	return static_cast<T>(v);
+}
+
+struct column_def
+{
+	const char*       name;
+	trace_column_type type;
+	uint16_t          offset;
+	uint32_t          units_per_second;
+};
+
+// The layout of a record. Column names match the CSV trace.
+const column_def record_columns[] = {
+	{"usTimepointSys", trace_column_type::i64, 0, 1000000},
+	{"usElapsedStd", trace_column_type::i64, 8, 1000000},
+	{"usElapsedSys", trace_column_type::i64, 16, 1000000},
+	{"usElapsedKernelStd", trace_column_type::i64, 24, 1000000},
+	{"usAckAckTimestampStd", trace_column_type::u32, 32, 1000000},
+	{"usAckAckTimestampSys", trace_column_type::u32, 36, 1000000},
+	{"usRTTSys", trace_column_type::i32, 40, 1000000},
+	{"usRTTStd", trace_column_type::i32, 44, 1000000},
+	{"usSmoothedRTTStd", trace_column_type::i32, 48, 1000000},
+	{"RTTVarStd", trace_column_type::i32, 52, 1000000},
+	{"usDriftSampleStd", trace_column_type::i64, 56, 1000000},
+	{"usDriftStd", trace_column_type::i64, 64, 1000000},
+	{"usOverdriftStd", trace_column_type::i64, 72, 1000000},
+	{"nsTsbpdTimeBaseStd", trace_column_type::i64, 80, 1000000000},
+	{"usDriftEstStd", trace_column_type::i32, 88, 1000000},
+	{"ppbSkewEst", trace_column_type::i32, 92, 0},
+};
+
+// Version 1 records end with nsTsbpdTimeBaseStd.
+constexpr size_t record_size_v1 = 88;
+
+constexpr size_t column_name_size = 32;
+constexpr size_t column_count     = sizeof(record_columns) / sizeof(record_columns[0]);
+
+} // namespace
+
+bool is_trace_file(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	char     magic[sizeof trace_file_magic];
+	return in.read(magic, sizeof magic) && memcmp(magic, trace_file_magic, sizeof magic) == 0;
+}
+
+void encode_trace_row(const trace_row& row, uint8_t* rec)
+{
+	store_le(rec + 0, row.us_timepoint_sys);
+	store_le(rec + 8, row.us_elapsed_std);
+	store_le(rec + 16, row.us_elapsed_sys);
+	store_le(rec + 24, row.us_elapsed_kernel_std);
+	store_le(rec + 32, row.us_ackack_timestamp_std);
+	store_le(rec + 36, row.us_ackack_timestamp_sys);
+	store_le(rec + 40, row.us_rtt_sys);
+	store_le(rec + 44, row.us_rtt_std);
+	store_le(rec + 48, row.us_smoothed_rtt_std);
+	store_le(rec + 52, row.rtt_var_std);
+	store_le(rec + 56, row.us_drift_sample_std);
+	store_le(rec + 64, row.us_drift_std);
+	store_le(rec + 72, row.us_overdrift_std);
+	store_le(rec + 80, row.ns_tsbpd_time_base_std);
+	store_le(rec + 88, row.us_drift_est_std);
+	store_le(rec + 92, row.ppb_skew_est);
+}
+
+trace_row decode_trace_row(const uint8_t* rec)
+{
+	trace_row row;
+	row.us_timepoint_sys        = load_le<int64_t>(rec + 0);
+	row.us_elapsed_std          = load_le<int64_t>(rec + 8);
+	row.us_elapsed_sys          = load_le<int64_t>(rec + 16);
+	row.us_elapsed_kernel_std   = load_le<int64_t>(rec + 24);
+	row.us_ackack_timestamp_std = load_le<uint32_t>(rec + 32);
+	row.us_ackack_timestamp_sys = load_le<uint32_t>(rec + 36);
+	row.us_rtt_sys              = load_le<int32_t>(rec + 40);
+	row.us_rtt_std              = load_le<int32_t>(rec + 44);
+	row.us_smoothed_rtt_std     = load_le<int32_t>(rec + 48);
+	row.rtt_var_std             = load_le<int32_t>(rec + 52);
+	row.us_drift_sample_std     = load_le<int64_t>(rec + 56);
+	row.us_drift_std            = load_le<int64_t>(rec + 64);
+	row.us_overdrift_std        = load_le<int64_t>(rec + 72);
+	row.ns_tsbpd_time_base_std  = load_le<int64_t>(rec + 80);
+	row.us_drift_est_std        = load_le<int32_t>(rec + 88);
+	row.ppb_skew_est            = load_le<int32_t>(rec + 92);
+	return row;
+}
+
+namespace
+{
+
+struct header_fields
+{
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t header_size;
+	uint16_t column_count;
+	uint32_t config_size;
+};
+
+/// @returns false if @a data is not a header of a trace file.
+bool parse_header(const uint8_t* data, size_t size, header_fields& h)
+{
+	if (size < trace_file_header_size || memcmp(data, trace_file_magic, sizeof trace_file_magic) != 0)
+		return false;
+
+	h.version      = load_le<uint16_t>(data + 8);
+	h.record_size  = load_le<uint16_t>(data + 10);
+	h.header_size  = load_le<uint32_t>(data + 12);
+	h.column_count = load_le<uint16_t>(data + 24);
+	h.config_size  = load_le<uint32_t>(data + 28);
+	return h.header_size <= size &&
+		   trace_file_header_size + h.column_count * trace_file_column_size + h.config_size <= h.header_size;
+}
+
+struct footer_fields
+{
+	uint64_t index_offset;
+	uint64_t index_count;
+	uint64_t record_count;
+};
+
+/// @returns false if the file does not end with a valid footer.
+bool parse_footer(const uint8_t* footer, uint64_t file_size, uint64_t header_size, uint64_t record_size,
+	footer_fields& f)
+{
+	if (memcmp(footer, trace_file_footer_magic, sizeof trace_file_footer_magic) != 0)
+		return false;
+
+	f.index_offset = load_le<uint64_t>(footer + 8);
+	f.index_count  = load_le<uint64_t>(footer + 16);
+	f.record_count = load_le<uint64_t>(footer + 24);
+	return f.index_offset == header_size + f.record_count * record_size &&
+		   f.index_offset + f.index_count * trace_file_index_entry_size + trace_file_footer_size == file_size;
+}
+
+} // namespace
+
+trace_file_writer::trace_file_writer(const string& filename, const string& config, bool append)
+{
+	error_code ec;
+	const auto existing_size = filesystem::file_size(filename, ec);
+	if (append && !ec && existing_size > 0)
+	{
+		reopen(filename);
+		m_out.open(filename, ios::binary | ios::app);
+	}
+	else
+	{
+		m_out.open(filename, ios::binary | ios::trunc);
+		if (m_out)
+			write_header(config);
+	}
+
+	if (!m_out)
+		throw runtime_error("Failed to open " + filename + "!!!");
+}
+
+trace_file_writer::~trace_file_writer()
+{
+	close();
+}
+
+void trace_file_writer::write_header(const string& config)
+{
+	// 0: magic, 8: version, 10: record size, 12: header size, 16: index stride,
+	// 24: column count, 28: config size, then the columns and the config text.
+	// A column: 0: name (zero-terminated), 32: type, 34: offset in a record, 36: units per second.
+	const size_t unpadded = trace_file_header_size + column_count * trace_file_column_size + config.size();
+	m_header_size         = (unpadded + 7) / 8 * 8;
+
+	vector<uint8_t> header(m_header_size, 0);
+	uint8_t*        h = header.data();
+	memcpy(h, trace_file_magic, sizeof trace_file_magic);
+	store_le(h + 8, trace_file_version);
+	store_le(h + 10, static_cast<uint16_t>(trace_file_record_size));
+	store_le(h + 12, static_cast<uint32_t>(m_header_size));
+	store_le(h + 16, static_cast<uint64_t>(trace_file_index_stride));
+	store_le(h + 24, static_cast<uint16_t>(column_count));
+	store_le(h + 28, static_cast<uint32_t>(config.size()));
+
+	uint8_t* col = h + trace_file_header_size;
+	for (const column_def& c : record_columns)
+	{
+		strncpy(reinterpret_cast<char*>(col), c.name, column_name_size - 1);
+		col[column_name_size] = static_cast<uint8_t>(c.type);
+		store_le(col + column_name_size + 2, c.offset);
+		store_le(col + column_name_size + 4, c.units_per_second);
+		col += trace_file_column_size;
+	}
+	memcpy(col, config.data(), config.size());
+
+	m_out.write(reinterpret_cast<const char*>(h), header.size());
+}
+
+void trace_file_writer::reopen(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	if (!in)
+		throw runtime_error("Failed to open " + filename + "!!!");
+
+	const uint64_t file_size = filesystem::file_size(filename);
+	uint8_t        head[trace_file_header_size];
+	header_fields  h;
+	if (!in.read(reinterpret_cast<char*>(head), sizeof head) || !parse_header(head, file_size, h) ||
+		h.version != trace_file_version || h.record_size != trace_file_record_size)
+		throw runtime_error(filename + " is not a compatible binary trace file");
+	m_header_size = h.header_size;
+
+	// Drop the index and the footer of a properly closed file, or an incomplete record at the end.
+	footer_fields f;
+	uint8_t       footer[trace_file_footer_size];
+	if (file_size >= m_header_size + trace_file_footer_size &&
+		in.seekg(file_size - trace_file_footer_size) &&
+		in.read(reinterpret_cast<char*>(footer), sizeof footer) &&
+		parse_footer(footer, file_size, m_header_size, trace_file_record_size, f))
+		m_record_count = f.record_count;
+	else
+		m_record_count = (file_size - m_header_size) / trace_file_record_size;
+	in.clear();
+
+	for (uint64_t i = 0; i < m_record_count; i += trace_file_index_stride)
+	{
+		uint8_t rec[sizeof(int64_t)];
+		in.seekg(m_header_size + i * trace_file_record_size);
+		in.read(reinterpret_cast<char*>(rec), sizeof rec);
+		m_index.emplace_back(load_le<int64_t>(rec), i);
+	}
+	in.close();
+
+	filesystem::resize_file(filename, m_header_size + m_record_count * trace_file_record_size);
+}
+
+void trace_file_writer::write(const trace_row& row)
+{
+	if (m_record_count % trace_file_index_stride == 0)
+		m_index.emplace_back(row.us_timepoint_sys, m_record_count);
+
+	uint8_t rec[trace_file_record_size];
+	encode_trace_row(row, rec);
+	m_out.write(reinterpret_cast<const char*>(rec), sizeof rec);
+	++m_record_count;
+}
+
+void trace_file_writer::close()
+{
+	if (!m_out.is_open())
+		return;
+
+	const uint64_t index_offset = m_header_size + m_record_count * trace_file_record_size;
+	for (const auto& entry : m_index)
+	{
+		uint8_t e[trace_file_index_entry_size];
+		store_le(e, entry.first);
+		store_le(e + 8, entry.second);
+		m_out.write(reinterpret_cast<const char*>(e), sizeof e);
+	}
+
+	uint8_t footer[trace_file_footer_size];
+	memcpy(footer, trace_file_footer_magic, sizeof trace_file_footer_magic);
+	store_le(footer + 8, index_offset);
+	store_le(footer + 16, static_cast<uint64_t>(m_index.size()));
+	store_le(footer + 24, m_record_count);
+	m_out.write(reinterpret_cast<const char*>(footer), sizeof footer);
+	m_out.close();
+}
+
+trace_file_reader::trace_file_reader(const string& filename)
+	: m_file(filename)
+	, m_data(m_file.data())
+	, m_size(m_file.size())
+{
+	header_fields h;
+	if (!m_data || !parse_header(m_data, m_size, h))
+		throw runtime_error(filename + " is not a binary trace file");
+	if (!(h.version == trace_file_version && h.record_size == trace_file_record_size) &&
+		!(h.version == 1 && h.record_size == record_size_v1))
+		throw runtime_error(filename + ": unsupported binary trace version");
+	m_header_size = h.header_size;
+	m_record_size = h.record_size;
+
+	const uint8_t* col = m_data + trace_file_header_size;
+	for (size_t i = 0; i < h.column_count; ++i, col += trace_file_column_size)
+	{
+		trace_column c;
+		c.name             = string(reinterpret_cast<const char*>(col), strnlen(reinterpret_cast<const char*>(col), column_name_size));
+		c.type             = static_cast<trace_column_type>(col[column_name_size]);
+		c.offset           = load_le<uint16_t>(col + column_name_size + 2);
+		c.units_per_second = load_le<uint32_t>(col + column_name_size + 4);
+		m_columns.push_back(c);
+	}
+	m_config.assign(reinterpret_cast<const char*>(col), h.config_size);
+
+	footer_fields f;
+	if (m_size >= m_header_size + trace_file_footer_size &&
+		parse_footer(m_data + m_size - trace_file_footer_size, m_size, m_header_size, m_record_size, f))
+	{
+		m_record_count = f.record_count;
+		m_index_offset = f.index_offset;
+		m_index_count  = f.index_count;
+		m_has_index    = true;
+	}
+	else
+	{
+		// Not closed yet: read up to the last complete record.
+		m_record_count = (m_size - m_header_size) / m_record_size;
+	}
+}
+
+trace_row trace_file_reader::row(size_t i) const
+{
+	if (m_record_size == trace_file_record_size)
+		return decode_trace_row(record_data(i));
+
+	// An older record: the columns it does not have are zero.
+	uint8_t rec[trace_file_record_size] = {};
+	memcpy(rec, record_data(i), m_record_size);
+	return decode_trace_row(rec);
+}
+
+int64_t trace_file_reader::timepoint(size_t i) const
+{
+	return load_le<int64_t>(record_data(i));
+}
+
+int64_t trace_file_reader::index_time(size_t i) const
+{
+	return load_le<int64_t>(m_data + m_index_offset + i * trace_file_index_entry_size);
+}
+
+size_t trace_file_reader::lower_bound(int64_t us_time) const
+{
+	size_t first = 0;
+	size_t last  = m_record_count;
+
+	if (m_has_index)
+	{
+		// The first index entry not earlier than us_time bounds the block of records to search.
+		size_t lo = 0, hi = m_index_count;
+		while (lo < hi)
+		{
+			const size_t mid = lo + (hi - lo) / 2;
+			if (index_time(mid) < us_time)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		const uint8_t* index = m_data + m_index_offset;
+		if (lo < m_index_count)
+			last = static_cast<size_t>(load_le<uint64_t>(index + lo * trace_file_index_entry_size + 8));
+		if (lo > 0)
+			first = static_cast<size_t>(load_le<uint64_t>(index + (lo - 1) * trace_file_index_entry_size + 8));
+	}
+
+	while (first < last)
+	{
+		const size_t mid = first + (last - first) / 2;
+		if (timepoint(mid) < us_time)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return first;
+}
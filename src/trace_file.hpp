@@ -0,0 +1,187 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+/// Binary drift trace file.
+///
+/// @details
+/// All values are little-endian.
+///
+/// @code
+/// +--------------------------------------+
+/// | header (trace_file_header_size)      |
+/// | column descriptors                   |  column_count x trace_file_column_size
+/// | config text                          |  padded to 8 bytes
+/// +--------------------------------------+  header_size
+/// | records                              |  record_count x record_size
+/// +--------------------------------------+  index_offset
+/// | time index                           |  index_count x 16 bytes
+/// | footer (trace_file_footer_size)      |
+/// +--------------------------------------+
+/// @endcode
+///
+/// Records are written in the order of the system time column (usTimepointSys).
+/// Every trace_file_index_stride-th record has an entry in the time index { time, record no. }.
+/// The index and the footer are written when the file is closed; a file without them
+/// (e.g. still being written) is read up to its last complete record.
+///
+/// Version 1 files have no skew estimate columns (88-byte records); they are read with these columns set to 0.
+
+/// A row of the binary drift trace.
+struct trace_row
+{
+	int64_t  us_timepoint_sys;      // microseconds since the Unix epoch
+	int64_t  us_elapsed_std;
+	int64_t  us_elapsed_sys;
+	int64_t  us_elapsed_kernel_std;
+	uint32_t us_ackack_timestamp_std;
+	uint32_t us_ackack_timestamp_sys;
+	int32_t  us_rtt_sys;
+	int32_t  us_rtt_std;
+	int32_t  us_smoothed_rtt_std;
+	int32_t  rtt_var_std;
+	int64_t  us_drift_sample_std;
+	int64_t  us_drift_std;
+	int64_t  us_overdrift_std;
+	int64_t  ns_tsbpd_time_base_std; // steady clock time since its epoch
+	int32_t  us_drift_est_std;       // drift estimated by the skew estimator
+	int32_t  ppb_skew_est;           // clock skew estimated by the skew estimator, parts per billion
+};
+
+enum class trace_column_type : uint8_t
+{
+	i32 = 1,
+	u32 = 2,
+	i64 = 3,
+};
+
+struct trace_column
+{
+	std::string       name;
+	trace_column_type type;
+	uint16_t          offset;           // in a record
+	uint32_t          units_per_second; // resolution of a time column, 0 if the column is not a time
+};
+
+constexpr char     trace_file_magic[8]        = {'D', 'R', 'F', 'T', 'R', 'A', 'C', 'E'};
+constexpr char     trace_file_footer_magic[8] = {'D', 'R', 'F', 'T', 'I', 'N', 'D', 'X'};
+constexpr uint16_t trace_file_version         = 2;
+constexpr size_t   trace_file_header_size     = 32;
+constexpr size_t   trace_file_column_size     = 48;
+constexpr size_t   trace_file_record_size     = 96;
+constexpr size_t   trace_file_index_entry_size = 16;
+constexpr size_t   trace_file_footer_size     = 32;
+constexpr size_t   trace_file_index_stride    = 1024;
+
+/// Encode @a row as a record of trace_file_record_size bytes.
+void encode_trace_row(const trace_row& row, uint8_t* rec);
+
+/// Decode a record of trace_file_record_size bytes.
+trace_row decode_trace_row(const uint8_t* rec);
+
+/// Writes a binary drift trace.
+class trace_file_writer
+{
+public:
+	/// @param config text describing the tracing configuration, stored in the header
+	/// @param append continue an existing trace file (if it is not empty) instead of overwriting it
+	///
+	/// @throws std::runtime_error if the file can't be opened or the existing file is not a compatible trace.
+	trace_file_writer(const std::string& filename, const std::string& config, bool append = false);
+
+	/// Writes the index and closes the file.
+	~trace_file_writer();
+
+	trace_file_writer(const trace_file_writer&) = delete;
+	trace_file_writer& operator=(const trace_file_writer&) = delete;
+
+public:
+	void write(const trace_row& row);
+
+	/// Flush the written records to the file. The file stays readable without the index.
+	void flush() { m_out.flush(); }
+
+	/// Write the index and the footer and close the file.
+	void close();
+
+	uint64_t record_count() const { return m_record_count; }
+
+private:
+	void write_header(const std::string& config);
+
+	/// Read the header and the index of an existing file and truncate the index and the footer.
+	void reopen(const std::string& filename);
+
+private:
+	std::ofstream m_out;
+	uint64_t      m_header_size  = 0;
+	uint64_t      m_record_count = 0;
+
+	std::vector<std::pair<int64_t, uint64_t>> m_index; // { us_timepoint_sys, record no. }
+};
+
+/// Memory-mapped reader of a binary drift trace.
+/// Opening a file only maps it and validates the header: records are decoded on access.
+class trace_file_reader
+{
+public:
+	/// @throws std::runtime_error if the file can't be mapped or is not a trace file.
+	explicit trace_file_reader(const std::string& filename);
+
+	trace_file_reader(const trace_file_reader&) = delete;
+	trace_file_reader& operator=(const trace_file_reader&) = delete;
+
+public:
+	size_t size() const { return m_record_count; }
+
+	/// @returns true if the file has been closed properly and has the time index.
+	bool has_index() const { return m_has_index; }
+
+	const std::vector<trace_column>& columns() const { return m_columns; }
+
+	const std::string& config() const { return m_config; }
+
+	/// Decode the record @a i.
+	trace_row row(size_t i) const;
+
+	/// @returns The system time of the record @a i (microseconds since the Unix epoch).
+	int64_t timepoint(size_t i) const;
+
+	/// @returns The first record with the system time not less than @a us_time, or size() if there is none.
+	/// Takes O(log n): a binary search in the time index, then in the block of records it points to.
+	size_t lower_bound(int64_t us_time) const;
+
+	/// @returns The range of records [first, last) with system time in [us_from, us_to).
+	std::pair<size_t, size_t> range(int64_t us_from, int64_t us_to) const
+	{
+		return {lower_bound(us_from), lower_bound(us_to)};
+	}
+
+private:
+	const uint8_t* record_data(size_t i) const { return m_data + m_header_size + i * m_record_size; }
+	int64_t        index_time(size_t i) const;
+
+private:
+	const mapped_file m_file;
+	const uint8_t*    m_data = nullptr;
+	size_t            m_size = 0;
+
+	size_t m_header_size  = 0;
+	size_t m_record_size  = trace_file_record_size;
+	size_t m_record_count = 0;
+	size_t m_index_offset = 0;
+	size_t m_index_count  = 0;
+	bool   m_has_index    = false;
+
+	std::vector<trace_column> m_columns;
+	std::string               m_config;
+};
+
+/// @returns true if the file starts with the binary trace magic.
+bool is_trace_file(const std::string& filename);
@@ -0,0 +1,138 @@
+#include "trace_ring.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+
+template <typename T>
+void store_le(uint8_t* dst, T value)
+{
+	for (size_t i = 0; i < sizeof(T); ++i)
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+template <typename T>
+T load_le(const uint8_t* src)
+{
+	T v = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		v |= static_cast<T>(src[i]) << (8 * i);
+	return v;
+}
+
+constexpr size_t written_offset  = 24;
+constexpr size_t config_offset   = 36;
+constexpr size_t max_config_size = trace_ring_header_size - config_offset;
+
+uint64_t ring_capacity(size_t file_size)
+{
+	return file_size > trace_ring_header_size ? (file_size - trace_ring_header_size) / trace_file_record_size : 0;
+}
+
+/// Prepare continuing an existing circular trace.
+/// @returns The number of rows written to the file, or 0 if there is nothing to continue.
+uint64_t continued_rows(const string& filename, size_t file_size)
+{
+	error_code     ec;
+	const uint64_t existing_size = filesystem::file_size(filename, ec);
+	if (ec || existing_size == 0)
+		return 0;
+
+	ifstream in(filename, ios::binary);
+	uint8_t  h[config_offset];
+	if (in.read(reinterpret_cast<char*>(h), sizeof h) && existing_size == file_size &&
+		memcmp(h, trace_ring_magic, sizeof trace_ring_magic) == 0 && load_le<uint16_t>(h + 8) == trace_ring_version &&
+		load_le<uint16_t>(h + 10) == trace_file_record_size && load_le<uint64_t>(h + 16) == ring_capacity(file_size))
+		return load_le<uint64_t>(h + written_offset);
+	in.close();
+
+	// Another format or size: keep the rows, e.g. trace.bin -> trace-1.bin.
+	const size_t dot    = filename.find_last_of('.');
+	const size_t sep    = filename.find_last_of("/\\");
+	const bool   ext    = dot != string::npos && (sep == string::npos || dot > sep);
+	const string stem   = ext ? filename.substr(0, dot) : filename;
+	const string suffix = ext ? filename.substr(dot) : string();
+	string       old_name;
+	int          n = 0;
+	do
+	{
+		old_name = stem + "-" + to_string(++n) + suffix;
+	} while (filesystem::exists(old_name));
+
+	filesystem::rename(filename, old_name, ec);
+	if (ec)
+		throw runtime_error("Failed to rename " + filename + " to " + old_name + ": " + ec.message());
+	return 0;
+}
+
+} // namespace
+
+bool is_trace_ring(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	char     magic[sizeof trace_ring_magic];
+	return in.read(magic, sizeof magic) && memcmp(magic, trace_ring_magic, sizeof magic) == 0;
+}
+
+trace_ring_writer::trace_ring_writer(const string& filename, size_t file_size, const string& config, bool append)
+	: m_capacity(ring_capacity(file_size))
+	, m_written(append && m_capacity ? continued_rows(filename, file_size) : 0)
+	, m_file(filename, file_size, m_written > 0)
+{
+	if (m_capacity == 0)
+		throw runtime_error("The flight recorder file size is too small: " + to_string(file_size) + " bytes");
+
+	uint8_t*     h           = m_file.data();
+	const size_t config_size = min(config.size(), max_config_size);
+	memcpy(h, trace_ring_magic, sizeof trace_ring_magic);
+	store_le<uint16_t>(h + 8, trace_ring_version);
+	store_le<uint16_t>(h + 10, trace_file_record_size);
+	store_le<uint32_t>(h + 12, 0);
+	store_le<uint64_t>(h + 16, m_capacity);
+	store_le<uint64_t>(h + written_offset, m_written);
+	store_le<uint32_t>(h + 32, static_cast<uint32_t>(config_size));
+	memcpy(h + config_offset, config.data(), config_size);
+}
+
+void trace_ring_writer::write(const trace_row& row)
+{
+	uint8_t* rec = m_file.data() + trace_ring_header_size + (m_written % m_capacity) * trace_file_record_size;
+	encode_trace_row(row, rec);
+	++m_written;
+	store_le<uint64_t>(m_file.data() + written_offset, m_written);
+}
+
+trace_row trace_ring_writer::row(uint64_t i) const
+{
+	return decode_trace_row(m_file.data() + trace_ring_header_size + (i % m_capacity) * trace_file_record_size);
+}
+
+trace_ring_reader::trace_ring_reader(const string& filename)
+	: m_file(filename)
+{
+	const uint8_t* h = m_file.data();
+	if (!h || m_file.size() < trace_ring_header_size || memcmp(h, trace_ring_magic, sizeof trace_ring_magic) != 0)
+		throw runtime_error(filename + " is not a flight recorder file");
+	if (load_le<uint16_t>(h + 8) != trace_ring_version || load_le<uint16_t>(h + 10) != trace_file_record_size)
+		throw runtime_error(filename + ": unsupported flight recorder file version");
+
+	m_capacity = load_le<uint64_t>(h + 16);
+	m_written  = load_le<uint64_t>(h + written_offset);
+	if (m_capacity == 0 || trace_ring_header_size + m_capacity * trace_file_record_size > m_file.size())
+		throw runtime_error(filename + ": corrupted flight recorder header");
+
+	const size_t config_size = min<size_t>(load_le<uint32_t>(h + 32), max_config_size);
+	m_config.assign(reinterpret_cast<const char*>(h + config_offset), config_size);
+}
+
+trace_row trace_ring_reader::row(uint64_t i) const
+{
+	return decode_trace_row(m_file.data() + trace_ring_header_size + (i % m_capacity) * trace_file_record_size);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.hpp"
+#include "trace_file.hpp"
+
+/// Fixed-size circular binary trace (flight recorder).
+///
+/// @details
+/// All values are little-endian.
+///
+/// @code
+/// header (trace_ring_header_size): magic "DRFTRING" | version (u16) | record size (u16) | reserved (u32) |
+///                                  capacity (u64) | rows written (u64) | config size (u32) | config text
+/// records: capacity x trace_file_record_size
+/// @endcode
+///
+/// Records have the layout of the binary trace (trace_file.hpp). The row no. i is stored
+/// in the slot i % capacity, so the file holds the latest capacity rows. The number of rows
+/// written is updated after each row, so the file can be read after a crash.
+
+constexpr char     trace_ring_magic[8]    = {'D', 'R', 'F', 'T', 'R', 'I', 'N', 'G'};
+constexpr uint16_t trace_ring_version     = 2;
+constexpr size_t   trace_ring_header_size = 4096;
+
+/// Writes a circular trace into a memory-mapped file.
+class trace_ring_writer
+{
+public:
+	/// @param file_size the size of the file, including the header
+	/// @param config text describing the tracing configuration, stored in the header (truncated to fit)
+	/// @param append continue the rows of an existing circular trace of the same size instead of overwriting it.
+	///        A file that can't be continued is renamed to "<name>-<n>.<ext>" first.
+	///
+	/// @throws std::runtime_error if the file can't be created or its disk space reserved, or @a file_size is too small.
+	trace_ring_writer(const std::string& filename, size_t file_size, const std::string& config, bool append = false);
+
+public:
+	void write(const trace_row& row);
+
+	/// The total number of rows written.
+	uint64_t written() const { return m_written; }
+
+	/// The maximum number of rows the file holds.
+	uint64_t capacity() const { return m_capacity; }
+
+	/// The oldest row still in the file.
+	uint64_t first() const { return m_written > m_capacity ? m_written - m_capacity : 0; }
+
+	/// @param i row no. in [first(), written())
+	trace_row row(uint64_t i) const;
+
+	/// Schedule writing the modified pages to the disk.
+	void sync() { m_file.sync_async(); }
+
+private:
+	uint64_t    m_capacity = 0;
+	uint64_t    m_written  = 0; // initialized before the file is opened, see the constructor
+	mapped_file m_file;
+};
+
+/// Reads a circular trace from a memory-mapped file.
+class trace_ring_reader
+{
+public:
+	/// @throws std::runtime_error if the file can't be mapped or is not a circular trace.
+	explicit trace_ring_reader(const std::string& filename);
+
+public:
+	const std::string& config() const { return m_config; }
+
+	uint64_t capacity() const { return m_capacity; }
+
+	/// The oldest row in the file.
+	uint64_t first() const { return m_written > m_capacity ? m_written - m_capacity : 0; }
+
+	/// Past the newest row in the file.
+	uint64_t end() const { return m_written; }
+
+	/// @param i row no. in [first(), end())
+	trace_row row(uint64_t i) const;
+
+private:
+	const mapped_file m_file;
+	uint64_t          m_capacity = 0;
+	uint64_t          m_written  = 0;
+	std::string       m_config;
+};
+
+/// @returns true if the file starts with the circular trace magic.
+bool is_trace_ring(const std::string& filename);
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Map a signed value onto an unsigned one so that values of a small magnitude
+/// have a short varint: 0, -1, 1, -2, 2, ... -> 0, 1, 2, 3, 4, ...
+inline uint64_t zigzag_encode(int64_t value)
+{
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+/// Append @a value as a varint: 7 bits per byte, least significant group first,
+/// the high bit set on all bytes but the last one. Takes 1 to 10 bytes.
+inline void varint_append(std::vector<uint8_t>& out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+/// Read a varint from [@a pos, @a end) and advance @a pos past it.
+/// @returns false if the varint is truncated or longer than 10 bytes.
+inline bool varint_read(const uint8_t*& pos, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	for (unsigned shift = 0; shift < 64 && pos != end; shift += 7)
+	{
+		const uint8_t byte = *pos++;
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+/// CRC-32 (IEEE 802.3, as in zlib) of @a size bytes, continuing from @a crc.
+inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+	struct table
+	{
+		uint32_t values[256];
+
+		table()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				values[i] = c;
+			}
+		}
+	};
+	static const table t;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = t.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
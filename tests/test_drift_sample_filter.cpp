@@ -0,0 +1,108 @@
+#include "catch2/catch_all.hpp"
+
+#include "drift_sample_filter.hpp"
+
+TEST_CASE("Drift sample filter off forwards every sample", "[drift_sample_filter]")
+{
+	drift_sample_filter filter;
+	for (int64_t drift : {100, -100, 100000})
+	{
+		int64_t sample = drift;
+		REQUIRE(filter.filter(sample, {5000, 1000, 100}));
+		REQUIRE(sample == drift);
+	}
+	REQUIRE(filter.forwarded() == 3);
+	REQUIRE(filter.rejected() == 0);
+}
+
+TEST_CASE("Drift sample filter min-rtt forwards the lowest RTT of a window", "[drift_sample_filter]")
+{
+	REQUIRE(parse_drift_filter("min-rtt") == drift_filter::min_rtt);
+	drift_sample_filter filter(drift_filter::min_rtt);
+
+	// The window of 8 samples: the sample with the lowest RTT (900 us) has drift 42,
+	// the others are delayed by queueing.
+	const int rtts[8]       = {1500, 1200, 1100, 900, 1300, 2000, 950, 1000};
+	const int64_t drifts[8] = {600, 300, 200, 42, 400, 1100, 80, 100};
+	for (int i = 0; i < 8; ++i)
+	{
+		int64_t sample = drifts[i];
+		const bool forwarded = filter.filter(sample, {rtts[i], 1000, 100});
+		REQUIRE(forwarded == (i == 7));
+		if (forwarded)
+			REQUIRE(sample == 42);
+	}
+
+	// The next window starts over.
+	for (int i = 0; i < 8; ++i)
+	{
+		int64_t sample = 1000 + i;
+		if (filter.filter(sample, {2000 - i, 1000, 100}))
+			REQUIRE(sample == 1007);
+	}
+	REQUIRE(filter.forwarded() == 2);
+	REQUIRE(filter.rejected() == 14);
+}
+
+TEST_CASE("Drift sample filter rtt-gate rejects and weights by the RTT deviation", "[drift_sample_filter]")
+{
+	REQUIRE(parse_drift_filter("rtt-gate") == drift_filter::rtt_gate);
+	drift_sample_filter filter(drift_filter::rtt_gate);
+
+	// SRTT 1000 us, RTTVar 100 us: the gate is at 1400 us.
+	int64_t sample = 500;
+	REQUIRE(!filter.filter(sample, {1401, 1000, 100}));
+	REQUIRE(filter.rejected() == 1);
+
+	// The first forwarded sample is taken as is.
+	sample = 100;
+	REQUIRE(filter.filter(sample, {1000, 1000, 100}));
+	REQUIRE(sample == 100);
+
+	// Deviation 200 us, half of 4 * RTTVar: the weight is 4 of 8.
+	sample = 300;
+	REQUIRE(filter.filter(sample, {1200, 1000, 100}));
+	REQUIRE(sample == 200);
+
+	// No deviation: the full weight.
+	sample = 40;
+	REQUIRE(filter.filter(sample, {1000, 1000, 100}));
+	REQUIRE(sample == 40);
+
+	// The following samples are against the shifted time base.
+	filter.on_shift(1000);
+	sample = -960;
+	REQUIRE(filter.filter(sample, {1400, 1000, 100}));
+	REQUIRE(sample == -960);
+
+	// Before SRTT is known, every sample passes with the full weight.
+	drift_sample_filter fresh(drift_filter::rtt_gate);
+	sample = 7;
+	REQUIRE(fresh.filter(sample, {100000, 0, 0}));
+	REQUIRE(sample == 7);
+}
+
+TEST_CASE("Drift sample filter rejects samples without RTT", "[drift_sample_filter]")
+{
+	// The ACK record of a duplicate or reordered ACKACK is not found, its RTT is -1.
+	for (const drift_filter mode : {drift_filter::off, drift_filter::min_rtt, drift_filter::rtt_gate})
+	{
+		drift_sample_filter filter(mode);
+		int64_t sample = 5000;
+		REQUIRE(!filter.filter(sample, {-1, 1000, 100}));
+		REQUIRE(filter.rejected() == 1);
+		REQUIRE(filter.forwarded() == 0);
+	}
+
+	// A duplicate in a min-rtt window does not win it.
+	drift_sample_filter filter(drift_filter::min_rtt);
+	int64_t forwarded = 0;
+	for (int i = 0; i < 9; ++i)
+	{
+		int64_t sample = i == 2 ? 5000 : 100 + i;
+		if (filter.filter(sample, {i == 2 ? -1 : 1000 - i, 1000, 100}))
+			forwarded = sample;
+	}
+	REQUIRE(filter.forwarded() == 1);
+	REQUIRE(forwarded == 108);
+}
@@ -0,0 +1,117 @@
+#include "catch2/catch_all.hpp"
+
+#include <cmath>
+#include <random>
+
+#include "kalman_drift_tracer.hpp"
+
+TEST_CASE("Kalman drift tracer follows a skewed clock across shifts", "[kalman_drift_tracer]")
+{
+	for (const double skew_ppm : {30.0, -50.0})
+	{
+		std::mt19937 rng(7);
+		std::normal_distribution<double> jitter(0, 100);
+		KalmanDriftTracer<5000> tracer;
+
+		int64_t shifts_us        = 0;
+		int     num_shifts       = 0;
+		double  converged_s      = -1;
+		double  max_skew_error   = 0;
+		double  max_offset_error = 0;
+		for (int64_t t_us = 0; t_us < 300000000; t_us += 10000)
+		{
+			const double truth = 1000 + skew_ppm * t_us / 1e6;
+			// The sample is taken against the current time base, as in TSBPD.
+			const int64_t sample = std::llround(truth + jitter(rng)) - shifts_us;
+			if (tracer.update(sample, t_us, 100))
+			{
+				REQUIRE(std::abs(tracer.overdrift()) == 5000);
+				shifts_us += tracer.overdrift();
+				++num_shifts;
+			}
+			else
+			{
+				REQUIRE(tracer.overdrift() == 0);
+			}
+
+			const double skew_error = tracer.skew_ppm() - skew_ppm;
+			if (std::abs(skew_error) > 1)
+				converged_s = -1;
+			else if (converged_s < 0)
+				converged_s = t_us / 1e6;
+
+			if (t_us >= 60000000)
+			{
+				max_skew_error   = std::max(max_skew_error, std::abs(skew_error));
+				max_offset_error = std::max(max_offset_error, std::abs(tracer.drift() + shifts_us - truth));
+			}
+		}
+
+		INFO("skew " << skew_ppm << " ppm");
+		// The drift grows by 9000 us (30 ppm) or 15000 us (50 ppm) in 300 s,
+		// the shifts keep the drift against the current time base within MAX_DRIFT.
+		const double truth_end = 1000 + skew_ppm * 300;
+		REQUIRE(num_shifts >= 1);
+		REQUIRE(std::abs(truth_end - shifts_us) < 5000 + 100);
+		REQUIRE(converged_s >= 0);
+		REQUIRE(converged_s < 20);
+		REQUIRE(max_skew_error < 0.2);
+		REQUIRE(max_offset_error < 20);
+		REQUIRE(tracer.drift_variance() > 0);
+		REQUIRE(tracer.skew_variance() > 0);
+	}
+}
+
+TEST_CASE("Kalman drift tracer weights the samples by the RTT variance", "[kalman_drift_tracer]")
+{
+	// Every 20th sample is delayed by 3 ms. Declared with a high RTT variance, it barely moves the estimate.
+	const auto mean_error = [](int spike_rtt_var_us) {
+		std::mt19937 rng(2);
+		std::normal_distribution<double> jitter(0, 50);
+		KalmanDriftTracer<100000> tracer;
+
+		double sum = 0;
+		int    n   = 0;
+		for (int i = 0; i < 12000; ++i)
+		{
+			const int64_t t_us  = int64_t(i) * 10000;
+			const double  truth = 20 * t_us / 1e6;
+			const bool    spike = i % 20 == 10;
+			tracer.update(std::llround(truth + jitter(rng) + (spike ? 3000 : 0)), t_us, spike ? spike_rtt_var_us : 50);
+			if (t_us > 30000000)
+			{
+				sum += std::abs(tracer.drift() - truth);
+				++n;
+			}
+		}
+		return sum / n;
+	};
+
+	REQUIRE(mean_error(3000) < 10);
+	REQUIRE(mean_error(50) > 100);
+}
+
+TEST_CASE("Kalman drift tracer does not shift on an uncertain drift", "[kalman_drift_tracer]")
+{
+	KalmanDriftTracer<5000> tracer;
+
+	// The standard deviation of the first sample (2000 us) is above a quarter of MAX_DRIFT.
+	REQUIRE(!tracer.update(10000, 0, 2000));
+	REQUIRE(tracer.drift() == 10000);
+	REQUIRE(tracer.overdrift() == 0);
+
+	// The variance falls with more samples, then the time base is shifted once.
+	int     num_shifts = 0;
+	int64_t shifts_us  = 0;
+	for (int i = 1; i < 100; ++i)
+	{
+		if (tracer.update(10000 - shifts_us, i * 10000, 2000))
+		{
+			++num_shifts;
+			shifts_us += tracer.overdrift();
+		}
+	}
+	REQUIRE(num_shifts == 1);
+	REQUIRE(shifts_us == 5000);
+	REQUIRE(std::abs(tracer.drift() - 5000) < 100);
+}
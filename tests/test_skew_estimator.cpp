@@ -0,0 +1,88 @@
+#include "catch2/catch_all.hpp"
+
+#include <cmath>
+#include <random>
+
+#include "skew_estimator.hpp"
+
+namespace
+{
+
+/// Feed the drift samples of a clock with a constant skew and gaussian jitter.
+/// @returns The time (s) from which the skew estimate stayed within 1 ppm.
+template <class ON_SAMPLE>
+double feed_skewed_clock(double skew_ppm, int64_t duration_s, int64_t period_us, double jitter_us, ON_SAMPLE on_sample)
+{
+	std::mt19937 rng(static_cast<unsigned>(skew_ppm * 10 + 1000));
+	std::normal_distribution<double> jitter(0, jitter_us);
+
+	double converged_s = -1;
+	for (int64_t t_us = 0; t_us < duration_s * 1000000; t_us += period_us)
+	{
+		const double truth = 1000 + skew_ppm * t_us / 1e6;
+		const double skew_error = on_sample(t_us, std::llround(truth + jitter(rng)), truth);
+		if (std::abs(skew_error) > 1)
+			converged_s = -1;
+		else if (converged_s < 0)
+			converged_s = t_us / 1e6;
+	}
+	return converged_s;
+}
+
+} // namespace
+
+TEST_CASE("Skew estimator recovers a constant skew", "[skew_estimator]")
+{
+	for (const double skew_ppm : {30.0, -50.0, 0.0})
+	{
+		lsq_skew_estimator<> estimator;
+		double max_skew_error   = 0;
+		double max_offset_error = 0;
+
+		// 10 ms between samples, 100 us jitter, as on a LAN.
+		const double converged_s = feed_skewed_clock(skew_ppm, 300, 10000, 100,
+			[&](int64_t t_us, int64_t drift_us, double truth) {
+				estimator.update(t_us, drift_us);
+				const double skew_error = estimator.skew_ppm() - skew_ppm;
+				if (t_us >= 60000000)
+				{
+					max_skew_error   = std::max(max_skew_error, std::abs(skew_error));
+					max_offset_error = std::max(max_offset_error, std::abs(estimator.offset_us() - truth));
+				}
+				return skew_error;
+			});
+
+		INFO("skew " << skew_ppm << " ppm");
+		REQUIRE(converged_s >= 0);
+		REQUIRE(converged_s < 20);
+		REQUIRE(max_skew_error < 0.2);
+		REQUIRE(max_offset_error < 20);
+	}
+}
+
+TEST_CASE("Skew estimator stays accurate over a long run", "[skew_estimator]")
+{
+	lsq_skew_estimator<> estimator;
+	double max_skew_error = 0;
+
+	// 10 hours at 100 ms: the weighted sums are kept relative to the last sample, so they do not grow.
+	feed_skewed_clock(12.5, 10 * 3600, 100000, 100, [&](int64_t t_us, int64_t drift_us, double) {
+		estimator.update(t_us, drift_us);
+		const double skew_error = estimator.skew_ppm() - 12.5;
+		if (t_us >= 60000000)
+			max_skew_error = std::max(max_skew_error, std::abs(skew_error));
+		return skew_error;
+	});
+
+	REQUIRE(max_skew_error < 0.5);
+}
+
+TEST_CASE("Skew estimator with a single sample", "[skew_estimator]")
+{
+	lsq_skew_estimator<> estimator;
+	REQUIRE(estimator.offset_us() == 0);
+
+	estimator.update(5000000, -1234);
+	REQUIRE(estimator.offset_us() == -1234);
+	REQUIRE(estimator.skew_ppm() == 0);
+}
@@ -0,0 +1,69 @@
+#include "catch2/catch_all.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "sliding_median.hpp"
+
+namespace
+{
+
+int64_t brute_force_median(const std::deque<int64_t>& window)
+{
+	std::vector<int64_t> v(window.begin(), window.end());
+	std::sort(v.begin(), v.end());
+	const size_t mid = v.size() / 2;
+	if (v.size() % 2)
+		return v[mid];
+	return v[mid - 1] + (v[mid] - v[mid - 1]) / 2;
+}
+
+template <size_t N>
+void check_against_sort(int64_t range)
+{
+	sliding_median<int64_t, N> median;
+	std::deque<int64_t>         window;
+	std::mt19937                rng(static_cast<unsigned>(N));
+	std::uniform_int_distribution<int64_t> dist(-range, range);
+
+	for (int i = 0; i < 5000; ++i)
+	{
+		const int64_t value = dist(rng);
+		median.push(value);
+		window.push_back(value);
+		if (window.size() > N)
+			window.pop_front();
+
+		REQUIRE(median.size() == window.size());
+		REQUIRE(median.median() == brute_force_median(window));
+	}
+}
+
+} // namespace
+
+TEST_CASE("Sliding median matches sorting the window", "[sliding_median]")
+{
+	check_against_sort<1>(1000);
+	check_against_sort<2>(1000);
+	check_against_sort<7>(3); // many equal values
+	check_against_sort<64>(1000);
+	check_against_sort<1001>(1000000);
+}
+
+TEST_CASE("Sliding median ignores outliers", "[sliding_median]")
+{
+	sliding_median<int64_t, 5> median;
+	REQUIRE(median.median() == 0);
+
+	for (int64_t v : {10, 12, 11, 100000, 9})
+		median.push(v);
+	REQUIRE(median.median() == 11);
+
+	// A step change wins once the values above the old level are the majority of the window.
+	median.push(500); // 12, 11, 100000, 9, 500
+	REQUIRE(median.median() == 12);
+	median.push(500); // 11, 100000, 9, 500, 500
+	REQUIRE(median.median() == 500);
+}
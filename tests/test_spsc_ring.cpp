@@ -0,0 +1,61 @@
+#include "catch2/catch_all.hpp"
+
+#include <thread>
+
+#include "spsc_ring.hpp"
+
+TEST_CASE("SPSC ring push and pop", "[spsc_ring]")
+{
+	spsc_ring<int, 4> ring;
+	int value = 0;
+	REQUIRE(ring.empty());
+	REQUIRE(!ring.pop(value));
+
+	for (int i = 0; i < 4; ++i)
+		REQUIRE(ring.push(i));
+	REQUIRE(!ring.push(4)); // full
+	REQUIRE(ring.size() == 4);
+
+	REQUIRE(ring.pop(value));
+	REQUIRE(value == 0);
+	REQUIRE(ring.push(4)); // wraps around
+
+	for (int i = 1; i <= 4; ++i)
+	{
+		REQUIRE(ring.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(ring.empty());
+}
+
+TEST_CASE("SPSC ring between two threads", "[spsc_ring]")
+{
+	constexpr int count = 100000;
+	spsc_ring<int, 64> ring;
+
+	std::thread producer([&ring] {
+		for (int i = 0; i < count; ++i)
+		{
+			while (!ring.push(i))
+				std::this_thread::yield();
+		}
+	});
+
+	int  expected = 0;
+	bool in_order = true;
+	while (expected < count)
+	{
+		int value;
+		if (!ring.pop(value))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		in_order = in_order && value == expected;
+		++expected;
+	}
+	producer.join();
+
+	REQUIRE(in_order);
+	REQUIRE(ring.empty());
+}
@@ -0,0 +1,125 @@
+#include "catch2/catch_all.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "trace_archive.hpp"
+#include "varint.hpp"
+
+namespace
+{
+
+// A row of a steady trace: 10 ms ACK interval with some jitter and a slow drift.
+trace_row make_row(int64_t i)
+{
+	const int64_t jitter = (i * 7919) % 23;
+
+	trace_row row = {};
+	row.us_timepoint_sys        = 1600000000000000 + i * 10000 + jitter;
+	row.us_elapsed_std          = i * 10000 + jitter;
+	row.us_elapsed_sys          = i * 10000 + jitter + 1;
+	row.us_elapsed_kernel_std   = i * 10000 + jitter - 2;
+	row.us_ackack_timestamp_std = static_cast<uint32_t>(0xFFFF0000u + i * 10000); // wraps
+	row.us_ackack_timestamp_sys = static_cast<uint32_t>(i * 10000 + 3);
+	row.us_rtt_sys              = static_cast<int32_t>(300 + jitter);
+	row.us_rtt_std              = static_cast<int32_t>(300 + jitter);
+	row.us_smoothed_rtt_std     = 305;
+	row.rtt_var_std             = static_cast<int32_t>(jitter / 2);
+	row.us_drift_sample_std     = -jitter;
+	row.us_drift_std            = -i / 100;
+	row.us_overdrift_std        = 0;
+	row.ns_tsbpd_time_base_std  = 123456789012345;
+	row.us_drift_est_std        = static_cast<int32_t>(-i / 100 + jitter / 4);
+	row.ppb_skew_est            = static_cast<int32_t>(-30000 + i % 7);
+	return row;
+}
+
+bool same(const trace_row& a, const trace_row& b)
+{
+	return memcmp(&a, &b, sizeof a) == 0;
+}
+
+const std::string test_file = "test-trace-archive.dta";
+
+} // namespace
+
+TEST_CASE("Zig-zag varints", "[varint]")
+{
+	const int64_t values[] = {0, 1, -1, 63, -64, 64, 300, -300, INT64_MAX, INT64_MIN};
+	std::vector<uint8_t> buf;
+	for (int64_t v : values)
+		varint_append(buf, zigzag_encode(v));
+	REQUIRE(buf[0] == 0);
+	REQUIRE(buf[1] == 2);
+	REQUIRE(buf[2] == 1);
+
+	const uint8_t* pos = buf.data();
+	for (int64_t v : values)
+	{
+		uint64_t coded;
+		REQUIRE(varint_read(pos, buf.data() + buf.size(), coded));
+		REQUIRE(zigzag_decode(coded) == v);
+	}
+	REQUIRE(pos == buf.data() + buf.size());
+
+	uint64_t coded;
+	const uint8_t truncated[] = {0x80, 0x80};
+	pos                       = truncated;
+	REQUIRE(!varint_read(pos, truncated + sizeof truncated, coded));
+
+	const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	REQUIRE(crc32(check, sizeof check) == 0xCBF43926);
+}
+
+TEST_CASE("Trace archive round trip", "[trace_archive]")
+{
+	const int count = 2 * trace_archive_block_rows + 100;
+	{
+		trace_archive_writer writer(test_file, "ack_interval_us=10000");
+		for (int i = 0; i < count; ++i)
+			writer.write(make_row(i));
+	}
+
+	// A steady trace should take a few bytes per row.
+	std::ifstream in(test_file, std::ios::binary | std::ios::ate);
+	REQUIRE(static_cast<size_t>(in.tellg()) < count * 20);
+	in.close();
+
+	{
+		trace_archive_writer writer(test_file, "", true);
+		writer.write(make_row(count));
+	}
+
+	trace_archive_reader reader(test_file);
+	REQUIRE(reader.config() == "ack_interval_us=10000");
+	trace_row row;
+	int       n = 0;
+	bool      all_same = true;
+	while (reader.next(row))
+		all_same = all_same && same(row, make_row(n++));
+	REQUIRE(all_same);
+	REQUIRE(n == count + 1);
+}
+
+TEST_CASE("Trace archive checksum", "[trace_archive]")
+{
+	{
+		trace_archive_writer writer(test_file, "");
+		for (int i = 0; i < 100; ++i)
+			writer.write(make_row(i));
+	}
+
+	{
+		// Flip a byte of the payload.
+		std::fstream f(test_file, std::ios::binary | std::ios::in | std::ios::out);
+		f.seekp(16 + 12 + 50);
+		f.put('\x55');
+	}
+
+	trace_archive_reader reader(test_file);
+	trace_row row;
+	REQUIRE_THROWS_AS(reader.next(row), std::runtime_error);
+
+	std::remove(test_file.c_str());
+}
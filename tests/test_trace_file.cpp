@@ -0,0 +1,142 @@
+#include "catch2/catch_all.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "trace_file.hpp"
+
+namespace
+{
+
+trace_row make_row(int64_t i)
+{
+	trace_row row = {};
+	row.us_timepoint_sys        = 1600000000000000 + i * 10000;
+	row.us_elapsed_std          = i * 10000;
+	row.us_ackack_timestamp_std = static_cast<uint32_t>(i);
+	row.us_rtt_std              = static_cast<int32_t>(-i);
+	row.us_drift_std            = -i * 3;
+	row.ns_tsbpd_time_base_std  = 123456789012345;
+	row.us_drift_est_std        = static_cast<int32_t>(-i * 2);
+	row.ppb_skew_est            = -30000;
+	return row;
+}
+
+const std::string test_file = "test-trace-file.bin";
+
+} // namespace
+
+TEST_CASE("Binary trace round trip and time seek", "[trace_file]")
+{
+	const size_t count = 3 * trace_file_index_stride + 17;
+	{
+		trace_file_writer writer(test_file, "ack_interval_us=10000");
+		for (size_t i = 0; i < count; ++i)
+			writer.write(make_row(i));
+	}
+
+	trace_file_reader reader(test_file);
+	REQUIRE(reader.size() == count);
+	REQUIRE(reader.has_index());
+	REQUIRE(reader.config() == "ack_interval_us=10000");
+	REQUIRE(reader.columns().size() == 16);
+	REQUIRE(reader.columns()[0].name == "usTimepointSys");
+	REQUIRE(reader.columns()[13].units_per_second == 1000000000);
+
+	const trace_row row = reader.row(1500);
+	REQUIRE(row.us_elapsed_std == 15000000);
+	REQUIRE(row.us_ackack_timestamp_std == 1500);
+	REQUIRE(row.us_rtt_std == -1500);
+	REQUIRE(row.us_drift_std == -4500);
+	REQUIRE(row.ns_tsbpd_time_base_std == 123456789012345);
+	REQUIRE(row.us_drift_est_std == -3000);
+	REQUIRE(row.ppb_skew_est == -30000);
+
+	REQUIRE(reader.lower_bound(0) == 0);
+	REQUIRE(reader.lower_bound(make_row(2048).us_timepoint_sys) == 2048);
+	REQUIRE(reader.lower_bound(make_row(2048).us_timepoint_sys + 1) == 2049);
+	REQUIRE(reader.lower_bound(make_row(count).us_timepoint_sys) == count);
+
+	const auto r = reader.range(make_row(1000).us_timepoint_sys, make_row(1100).us_timepoint_sys);
+	REQUIRE(r.first == 1000);
+	REQUIRE(r.second == 1100);
+}
+
+TEST_CASE("Binary trace append", "[trace_file]")
+{
+	{
+		trace_file_writer writer(test_file, "");
+		for (int i = 0; i < 1500; ++i)
+			writer.write(make_row(i));
+	}
+	{
+		trace_file_writer writer(test_file, "", true);
+		REQUIRE(writer.record_count() == 1500);
+		for (int i = 1500; i < 2500; ++i)
+			writer.write(make_row(i));
+	}
+
+	trace_file_reader reader(test_file);
+	REQUIRE(reader.size() == 2500);
+	REQUIRE(reader.has_index());
+	REQUIRE(reader.row(1500).us_ackack_timestamp_std == 1500);
+	REQUIRE(reader.lower_bound(make_row(2100).us_timepoint_sys) == 2100);
+}
+
+TEST_CASE("Binary trace without the index", "[trace_file]")
+{
+	{
+		trace_file_writer writer(test_file, "");
+		for (int i = 0; i < 100; ++i)
+			writer.write(make_row(i));
+		writer.flush();
+
+		// The file is still being written.
+		trace_file_reader reader(test_file);
+		REQUIRE(!reader.has_index());
+		REQUIRE(reader.size() == 100);
+		REQUIRE(reader.lower_bound(make_row(42).us_timepoint_sys) == 42);
+	}
+
+	std::remove(test_file.c_str());
+}
+
+TEST_CASE("Binary trace version 1", "[trace_file]")
+{
+	{
+		trace_file_writer writer(test_file, "");
+		for (int i = 0; i < 100; ++i)
+			writer.write(make_row(i));
+	}
+
+	// Rewrite as version 1: 88-byte records without the skew estimate, no index.
+	std::vector<char> data;
+	{
+		std::ifstream in(test_file, std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	uint32_t header_size;
+	memcpy(&header_size, &data[12], sizeof header_size);
+	data[8]  = 1;
+	data[10] = 88;
+	{
+		std::ofstream out(test_file, std::ios::binary | std::ios::trunc);
+		out.write(data.data(), header_size);
+		for (int i = 0; i < 100; ++i)
+			out.write(&data[header_size + i * trace_file_record_size], 88);
+	}
+
+	trace_file_reader reader(test_file);
+	REQUIRE(reader.size() == 100);
+	REQUIRE(!reader.has_index());
+	REQUIRE(reader.row(42).us_drift_std == -126);
+	REQUIRE(reader.row(42).ns_tsbpd_time_base_std == 123456789012345);
+	REQUIRE(reader.row(42).us_drift_est_std == 0);
+	REQUIRE(reader.row(42).ppb_skew_est == 0);
+
+	REQUIRE_THROWS(trace_file_writer(test_file, "", true));
+	std::remove(test_file.c_str());
+}
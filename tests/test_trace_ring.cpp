@@ -0,0 +1,93 @@
+#include "catch2/catch_all.hpp"
+
+#include <cstdio>
+
+#include "trace_ring.hpp"
+
+TEST_CASE("Circular trace keeps the latest rows", "[trace_ring]")
+{
+	const std::string test_file = "test-trace-ring.bin";
+	const size_t      capacity  = 100;
+	{
+		trace_ring_writer writer(test_file, trace_ring_header_size + capacity * trace_file_record_size, "peer=x");
+		REQUIRE(writer.capacity() == capacity);
+
+		for (int i = 0; i < 250; ++i)
+		{
+			trace_row row        = {};
+			row.us_elapsed_std   = i;
+			row.us_drift_std     = -i;
+			writer.write(row);
+		}
+		REQUIRE(writer.written() == 250);
+		REQUIRE(writer.first() == 150);
+		REQUIRE(writer.row(249).us_elapsed_std == 249);
+
+		// The file is readable while it is being written.
+		trace_ring_reader reader(test_file);
+		REQUIRE(reader.first() == 150);
+		REQUIRE(reader.end() == 250);
+		REQUIRE(reader.config() == "peer=x");
+
+		bool in_order = true;
+		for (uint64_t i = reader.first(); i < reader.end(); ++i)
+			in_order = in_order && reader.row(i).us_elapsed_std == static_cast<int64_t>(i) &&
+					   reader.row(i).us_drift_std == -static_cast<int64_t>(i);
+		REQUIRE(in_order);
+	}
+
+	REQUIRE_THROWS_AS(trace_ring_writer(test_file, trace_ring_header_size, ""), std::runtime_error);
+	std::remove(test_file.c_str());
+}
+
+TEST_CASE("Circular trace is continued on append", "[trace_ring]")
+{
+	const std::string test_file = "test-trace-ring-append.bin";
+	const size_t      file_size = trace_ring_header_size + 100 * trace_file_record_size;
+	const auto write_rows = [](trace_ring_writer& writer, int from, int to) {
+		for (int i = from; i < to; ++i)
+		{
+			trace_row row      = {};
+			row.us_elapsed_std = i;
+			writer.write(row);
+		}
+	};
+	{
+		trace_ring_writer writer(test_file, file_size, "peer=x");
+		write_rows(writer, 0, 130);
+	}
+	{
+		// The peer is back: the rows go on after the existing ones.
+		trace_ring_writer writer(test_file, file_size, "peer=x", true);
+		REQUIRE(writer.written() == 130);
+		write_rows(writer, 130, 160);
+	}
+	{
+		trace_ring_reader reader(test_file);
+		REQUIRE(reader.first() == 60);
+		REQUIRE(reader.end() == 160);
+		bool in_order = true;
+		for (uint64_t i = reader.first(); i < reader.end(); ++i)
+			in_order = in_order && reader.row(i).us_elapsed_std == static_cast<int64_t>(i);
+		REQUIRE(in_order);
+	}
+
+	// Another size can't be continued: the file is kept under another name.
+	const std::string old_file = "test-trace-ring-append-1.bin";
+	{
+		trace_ring_writer writer(test_file, file_size + trace_file_record_size, "peer=x", true);
+		REQUIRE(writer.written() == 0);
+		REQUIRE(writer.capacity() == 101);
+	}
+	REQUIRE(trace_ring_reader(old_file).end() == 160);
+
+	// Without append the file is overwritten.
+	{
+		trace_ring_writer writer(test_file, file_size, "peer=x");
+		REQUIRE(writer.written() == 0);
+	}
+	REQUIRE(trace_ring_reader(test_file).end() == 0);
+
+	std::remove(test_file.c_str());
+	std::remove(old_file.c_str());
+}